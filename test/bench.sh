@@ -0,0 +1,90 @@
+#!/bin/sh
+# bench.sh - Render the shader corpus at a fixed size and frame count with
+# --bench, and print one row per shader. Rows carry the image variant
+# (MESA_IMAGE_VARIANT, set by the Dockerfile) so the tables of several Mesa
+# and LLVM builds can be concatenated and compared.
+#
+# Usage: bench.sh SHADERTOY OUT_DIR [SIZE] [FRAMES]
+set -e
+bin=$1
+out=$2
+size=${3:-640x360}
+frames=${4:-30}
+corpus=${CORPUS:-shaders/bench/corpus.txt}
+expected=${EXPECTED:-shaders/bench/expected.txt}
+variant=${MESA_IMAGE_VARIANT:-local}
+# Reference hashes are those of the default size and frame count
+check=0
+if [ "$size" = 640x360 ] && [ "$frames" = 30 ]; then
+  check=1
+fi
+
+# stage REPORT NAME FIELD: a field of stages_ms, or of startup_ms without one
+stage() {
+  if [ -n "$3" ]; then
+    sed -n "s/.*\"$2\": {[^}]*\"$3\": \([0-9.]*\).*/\1/p" "$1"
+  else
+    sed -n "s/^ *\"$2\": \([0-9.]*\),\{0,1\}$/\1/p" "$1"
+  fi
+}
+info() {
+  sed -n "s/^ *\"$2\": \"\(.*\)\",\{0,1\}$/\1/p" "$1"
+}
+
+mkdir -p "$out"
+tsv=$out/bench.tsv
+printf 'variant\tshader\tsize\tframes\tmean_ms\tp50_ms\tp95_ms\tp99_ms\tmax_ms\tgpu_p50_ms\tbuild_ms\tfirst_frame_ms\toutput\n' >"$tsv"
+failed=0
+header=0
+while read -r name args; do
+  case $name in '' | '#'*) continue ;; esac
+  report=$out/$name.json
+  frames_file=$out/$name.rgba
+  # shellcheck disable=SC2086 # args holds several options
+  if ! "$bin" $args --size="$size" --max-frames="$frames" \
+    --stream="$frames_file" --stream-format=rgba --bench="$report" \
+    >"$out/$name.log" 2>&1; then
+    echo "$name: failed, see $out/$name.log" >&2
+    failed=1
+    continue
+  fi
+  if [ $header = 0 ]; then
+    echo "# $variant: $(info "$report" gl_version), $(info "$report" gl_renderer)"
+    mesa=$(info "$report" mesa_version)
+    llvm=$(info "$report" llvm_version)
+    if [ $check = 1 ] && ! grep -q "^$mesa  *$llvm " "$expected"; then
+      echo "# No reference hashes for Mesa $mesa, LLVM $llvm in $expected"
+      check=0
+    fi
+    printf '%-10s %9s %9s %9s %9s %9s %9s %12s  %s\n' shader mean_ms p50_ms \
+      p95_ms p99_ms max_ms build_ms first_frame output
+    header=1
+  fi
+  hash=$(md5sum "$frames_file" | cut -d' ' -f1)
+  rm -f "$frames_file"
+  output=$hash
+  reference=$(awk -v m="$mesa" -v l="$llvm" -v n="$name" \
+    '$1 == m && $2 == l && $3 == n { print $4 }' "$expected")
+  if [ $check = 1 ] && [ -n "$reference" ]; then
+    if [ "$hash" = "$reference" ]; then
+      output=match
+    else
+      output="differs ($hash)"
+    fi
+  fi
+  mean=$(stage "$report" frame mean)
+  p50=$(stage "$report" frame p50)
+  p95=$(stage "$report" frame p95)
+  p99=$(stage "$report" frame p99)
+  max=$(stage "$report" frame max)
+  gpu=$(stage "$report" gpu p50)
+  build=$(stage "$report" build_programs)
+  first=$(stage "$report" first_frame)
+  printf '%-10s %9s %9s %9s %9s %9s %9s %12s  %s\n' "$name" "$mean" "$p50" \
+    "$p95" "$p99" "$max" "$build" "$first" "$output"
+  printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' "$variant" \
+    "$name" "$size" "$frames" "$mean" "$p50" "$p95" "$p99" "$max" "$gpu" \
+    "$build" "$first" "$output" >>"$tsv"
+done <"$corpus"
+echo "Wrote $tsv"
+exit $failed
@@ -0,0 +1,186 @@
+/**
+ * binarycache.h - On-disk cache of linked program binaries.
+ *
+ * A program is stored as the blob of glGetProgramBinary in
+ * <dir>/<key>.bin. The key hashes every source string given to the compiler
+ * with the GL vendor, renderer and version. The file also holds a second hash
+ * and the total length of the sources, and the driver strings themselves.
+ * All of them must match before the blob is loaded, so neither a hash
+ * collision nor a driver update loads the wrong binary. On a hit
+ * glProgramBinary replaces compiling and linking, which skips the LLVM JIT on
+ * llvmpipe. Files are written to a temporary name and renamed, so concurrent
+ * runs sharing the directory never read a partial file.
+ *
+ * Include after glad/gl.h.
+ */
+#pragma once
+#include "hash.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BINARY_CACHE_MAGIC 0x32505453u // "STP2"
+#define BINARY_CACHE_CHECK_BASIS 0x84222325cbf29ce4ULL // Second hash seed
+#define BINARY_CACHE_DRIVER_SIZE 512
+
+// Identity of a program: its sources, and the driver through the cache
+typedef struct __ProgramBinaryKey {
+  uint64_t hash;   // File name, with the driver
+  uint64_t check;  // Second hash of the sources
+  uint64_t length; // Total length of the sources
+} ProgramBinaryKey;
+
+// Followed by the driver string and the blob
+typedef struct __ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t format; // glProgramBinary format
+  ProgramBinaryKey key;
+  uint32_t driverLength;
+  uint32_t blobLength;
+} ProgramBinaryHeader;
+
+typedef struct __ProgramBinaryCache {
+  const char *dir; // NULL disables the cache
+  uint64_t driver; // Hash of the GL vendor, renderer and version
+  char driverString[BINARY_CACHE_DRIVER_SIZE]; // The same, one per line
+  uint32_t driverLength;
+  atomic_ullong hits;
+  atomic_ullong misses;
+  atomic_ullong stores;
+} ProgramBinaryCache;
+
+/**
+ * Enable the cache in `dir`, which must exist, for the driver of the current
+ * context. Returns -1 and leaves the cache disabled if the driver cannot
+ * export program binaries.
+ */
+static int binaryCacheInit(ProgramBinaryCache *cache, const char *dir) {
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats <= 0)
+    return -1;
+  uint64_t driver = FNV_OFFSET_BASIS;
+  driver = hashString(driver, (const char *)glGetString(GL_VENDOR));
+  driver = hashString(driver, (const char *)glGetString(GL_RENDERER));
+  driver = hashString(driver, (const char *)glGetString(GL_VERSION));
+  int length = snprintf(cache->driverString, sizeof(cache->driverString),
+                        "%s\n%s\n%s\n", glGetString(GL_VENDOR),
+                        glGetString(GL_RENDERER), glGetString(GL_VERSION));
+  if (length < 0 || length >= (int)sizeof(cache->driverString))
+    return -1;
+  cache->driverLength = (uint32_t)length;
+  cache->driver = driver;
+  cache->dir = dir;
+  return 0;
+}
+
+// Key of a program built from `count` source strings, in order.
+static ProgramBinaryKey binaryCacheKey(const ProgramBinaryCache *cache,
+                                       const char *const *sources,
+                                       int count) {
+  ProgramBinaryKey key = {cache->driver, BINARY_CACHE_CHECK_BASIS, 0};
+  for (int i = 0; i < count; i++) {
+    key.hash = hashString(key.hash, sources[i]);
+    key.check = hashString(key.check, sources[i]);
+    key.length += strlen(sources[i]) + 1;
+  }
+  return key;
+}
+
+static void binaryCachePath(const ProgramBinaryCache *cache,
+                            const ProgramBinaryKey *key, char *path,
+                            size_t size) {
+  snprintf(path, size, "%s/%016llx.bin", cache->dir,
+           (unsigned long long)key->hash);
+}
+
+/**
+ * Program for `key` loaded from the cache, already linked, or 0 on a miss.
+ * A file written for other sources or another driver is a miss.
+ */
+static GLuint binaryCacheLoad(ProgramBinaryCache *cache,
+                              const ProgramBinaryKey *key) {
+  if (cache->dir == NULL)
+    return 0;
+  char path[4096];
+  binaryCachePath(cache, key, path, sizeof(path));
+  GLuint prog = 0;
+  void *blob = NULL;
+  FILE *f = fopen(path, "rb");
+  ProgramBinaryHeader header;
+  char driver[BINARY_CACHE_DRIVER_SIZE];
+  long size = 0;
+  if (f == NULL || fread(&header, sizeof(header), 1, f) != 1 ||
+      header.magic != BINARY_CACHE_MAGIC || header.key.hash != key->hash ||
+      header.key.check != key->check || header.key.length != key->length ||
+      header.driverLength != cache->driverLength ||
+      fread(driver, header.driverLength, 1, f) != 1 ||
+      memcmp(driver, cache->driverString, header.driverLength) != 0)
+    goto done;
+  long start = ftell(f);
+  fseek(f, 0, SEEK_END);
+  size = ftell(f) - start;
+  fseek(f, start, SEEK_SET);
+  if (size != (long)header.blobLength) // Truncated or padded
+    goto done;
+  blob = malloc(size > 0 ? size : 1);
+  if (size <= 0 || blob == NULL || fread(blob, size, 1, f) != 1)
+    goto done;
+  prog = glCreateProgram();
+  glProgramBinary(prog, header.format, blob, (GLsizei)size);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+  if (!linked) { // Rejected by the driver, rebuild it
+    glDeleteProgram(prog);
+    prog = 0;
+  }
+done:
+  if (f != NULL)
+    fclose(f);
+  free(blob);
+  atomic_fetch_add(prog != 0 ? &cache->hits : &cache->misses, 1);
+  return prog;
+}
+
+// Linking must have been preceded by GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+static void binaryCacheStore(ProgramBinaryCache *cache,
+                             const ProgramBinaryKey *key, GLuint prog) {
+  if (cache->dir == NULL)
+    return;
+  GLint size = 0;
+  glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+  void *blob = size > 0 ? malloc(size) : NULL;
+  if (blob == NULL)
+    return;
+  ProgramBinaryHeader header = {.magic = BINARY_CACHE_MAGIC,
+                                .key = *key,
+                                .driverLength = cache->driverLength};
+  GLenum format = 0;
+  glGetProgramBinary(prog, size, &size, &format, blob);
+  header.format = format;
+  header.blobLength = (uint32_t)size;
+  char path[4096], tmp[4096];
+  binaryCachePath(cache, key, path, sizeof(path));
+  snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", cache->dir);
+  int fd = mkstemp(tmp);
+  if (fd >= 0)
+    fchmod(fd, 0644); // Readable by other runs, like a plain fopen
+
+  FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  int ok = f != NULL && fwrite(&header, sizeof(header), 1, f) == 1 &&
+           fwrite(cache->driverString, cache->driverLength, 1, f) == 1 &&
+           fwrite(blob, size, 1, f) == 1;
+  if (f != NULL)
+    ok = fclose(f) == 0 && ok;
+  else if (fd >= 0)
+    close(fd);
+  if (ok && rename(tmp, path) == 0)
+    atomic_fetch_add(&cache->stores, 1);
+  else if (fd >= 0)
+    unlink(tmp);
+  free(blob);
+}
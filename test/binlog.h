@@ -0,0 +1,348 @@
+/**
+ * binlog.h - Binary diagnostic log behind the log() macro.
+ *
+ * log(fmt, ...) does not format anything. It stores the address of a static
+ * call site, which holds the format string, file and line. It also stores a
+ * timestamp and the raw arguments: integers, doubles and copies of strings.
+ * The record goes into a ring owned by the calling thread. Each ring has a
+ * single producer and a single consumer, so recording takes no lock and never
+ * blocks. Records are formatted later: by a background flusher started with
+ * binlogStart, or from the handler of a fatal signal.
+ *
+ * Without a flusher, a full ring overwrites its oldest records, so a crash
+ * prints the last records of every thread. With one, records that find their
+ * ring full are dropped and counted.
+ */
+#pragma once
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BINLOG_MAX_THREADS 64
+#define BINLOG_RING_RECORDS 512 // Per thread, a power of two
+#define BINLOG_MAX_ARGS 8
+#define BINLOG_TEXT_SIZE 384 // String arguments of one record
+#define BINLOG_FLUSH_MS 20   // Flusher period
+
+typedef struct __BinlogSite {
+  const char *format;
+  const char *file;
+  int line;
+} BinlogSite;
+
+typedef enum __BinlogType {
+  BINLOG_INT,
+  BINLOG_DOUBLE,
+  BINLOG_STRING,
+} BinlogType;
+
+typedef struct __BinlogArg {
+  BinlogType type;
+  union {
+    int64_t i;
+    double f;
+    const char *s;
+  };
+} BinlogArg;
+
+typedef struct __BinlogRecord {
+  const BinlogSite *site; // The format id
+  uint64_t ns;            // CLOCK_MONOTONIC
+  uint8_t count;
+  uint8_t types[BINLOG_MAX_ARGS];
+  union {
+    int64_t i;
+    double f;
+    uint16_t text; // Offset of a string in text
+  } values[BINLOG_MAX_ARGS];
+  char text[BINLOG_TEXT_SIZE];
+} BinlogRecord;
+
+typedef struct __BinlogRing {
+  BinlogRecord records[BINLOG_RING_RECORDS];
+  atomic_uint head; // Next record written, by the owning thread
+  atomic_uint tail; // Next record formatted
+  unsigned int tid;
+  atomic_ullong dropped;
+} BinlogRing;
+
+typedef struct __Binlog {
+  _Atomic(BinlogRing *) rings[BINLOG_MAX_THREADS]; // NULL until registered
+  atomic_uint ringCount;
+  atomic_int flushing; // A flusher consumes the rings
+  atomic_int stop;
+  pthread_t flusher;
+  pthread_mutex_t drainLock; // One consumer at a time
+  FILE *out;
+  uint64_t origin;
+} Binlog;
+
+static Binlog binlog = {.drainLock = PTHREAD_MUTEX_INITIALIZER};
+static __thread BinlogRing *binlogRing;
+
+static uint64_t binlogNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static BinlogArg binlogInt(int64_t i) {
+  return (BinlogArg){.type = BINLOG_INT, .i = i};
+}
+static BinlogArg binlogDouble(double f) {
+  return (BinlogArg){.type = BINLOG_DOUBLE, .f = f};
+}
+static BinlogArg binlogString(const char *s) {
+  return (BinlogArg){.type = BINLOG_STRING, .s = s};
+}
+
+// Classify an argument at compile time, pointers other than strings are not
+// supported.
+#define BINLOG_ARG(x)                                                          \
+  _Generic((x),                                                                \
+      float: binlogDouble,                                                     \
+      double: binlogDouble,                                                    \
+      char *: binlogString,                                                    \
+      const char *: binlogString,                                              \
+      default: binlogInt)(x)
+#define BINLOG_NARGS(...)                                                      \
+  BINLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BINLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define BINLOG_CAT(a, b) BINLOG_CAT_(a, b)
+#define BINLOG_CAT_(a, b) a##b
+#define BINLOG_EACH_0()
+#define BINLOG_EACH_1(a) , BINLOG_ARG(a)
+#define BINLOG_EACH_2(a, ...) , BINLOG_ARG(a) BINLOG_EACH_1(__VA_ARGS__)
+#define BINLOG_EACH_3(a, ...) , BINLOG_ARG(a) BINLOG_EACH_2(__VA_ARGS__)
+#define BINLOG_EACH_4(a, ...) , BINLOG_ARG(a) BINLOG_EACH_3(__VA_ARGS__)
+#define BINLOG_EACH_5(a, ...) , BINLOG_ARG(a) BINLOG_EACH_4(__VA_ARGS__)
+#define BINLOG_EACH_6(a, ...) , BINLOG_ARG(a) BINLOG_EACH_5(__VA_ARGS__)
+#define BINLOG_EACH_7(a, ...) , BINLOG_ARG(a) BINLOG_EACH_6(__VA_ARGS__)
+#define BINLOG_EACH_8(a, ...) , BINLOG_ARG(a) BINLOG_EACH_7(__VA_ARGS__)
+
+// Record a printf-style message, see the top of the file.
+#define log(fmt, ...)                                                          \
+  do {                                                                         \
+    static const BinlogSite binlogSite_ = {fmt, __FILE__, __LINE__};           \
+    const BinlogArg binlogArgs_[] = {                                          \
+        {.type = BINLOG_INT} BINLOG_CAT(BINLOG_EACH_,                          \
+                                        BINLOG_NARGS(__VA_ARGS__))(            \
+            __VA_ARGS__)};                                                     \
+    binlogWrite(&binlogSite_, binlogArgs_ + 1,                                 \
+                sizeof(binlogArgs_) / sizeof(binlogArgs_[0]) - 1);             \
+  } while (0)
+
+// The calling thread's ring, NULL if the thread limit is reached.
+static BinlogRing *binlogThreadRing(void) {
+  if (binlogRing == NULL) {
+    unsigned int tid = atomic_fetch_add(&binlog.ringCount, 1);
+    if (tid >= BINLOG_MAX_THREADS)
+      return NULL;
+    BinlogRing *ring = calloc(1, sizeof(BinlogRing));
+    if (ring == NULL)
+      return NULL;
+    ring->tid = tid;
+    binlogRing = ring;
+    // Published last: consumers skip NULL slots
+    atomic_store(&binlog.rings[tid], ring);
+  }
+  return binlogRing;
+}
+
+static void binlogWrite(const BinlogSite *site, const BinlogArg *args,
+                        int count) {
+  BinlogRing *ring = binlogThreadRing();
+  if (ring == NULL)
+    return;
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail == BINLOG_RING_RECORDS) {
+    // Without a flusher keep the newest records for a crash report
+    if (atomic_load_explicit(&binlog.flushing, memory_order_relaxed) ||
+        !atomic_compare_exchange_strong(&ring->tail, &tail, tail + 1)) {
+      atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+      return;
+    }
+  }
+  BinlogRecord *r = &ring->records[head % BINLOG_RING_RECORDS];
+  r->site = site;
+  r->ns = binlogNow();
+  r->count = count < BINLOG_MAX_ARGS ? count : BINLOG_MAX_ARGS;
+  size_t used = 0;
+  for (int i = 0; i < r->count; i++) {
+    r->types[i] = args[i].type;
+    if (args[i].type == BINLOG_INT) {
+      r->values[i].i = args[i].i;
+    } else if (args[i].type == BINLOG_DOUBLE) {
+      r->values[i].f = args[i].f;
+    } else { // Truncated to the space left
+      const char *s = args[i].s != NULL ? args[i].s : "(null)";
+      size_t len = strnlen(s, BINLOG_TEXT_SIZE - 1 - used);
+      memcpy(r->text + used, s, len);
+      r->text[used + len] = '\0';
+      r->values[i].text = (uint16_t)used;
+      used += len + (used + len + 1 < BINLOG_TEXT_SIZE);
+    }
+  }
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Format `r` into `buf` by walking its format string and printing each
+ * conversion with the stored argument. Returns the length written.
+ */
+static size_t binlogFormat(const BinlogRecord *r, unsigned int tid, char *buf,
+                           size_t size) {
+  size_t n = snprintf(buf, size, "[%10.3f ms T%u] ",
+                      (r->ns - binlog.origin) / 1e6, tid);
+  const char *p = r->site->format;
+  int arg = 0;
+  while (*p && n + 1 < size) {
+    if (*p != '%' || p[1] == '%') {
+      buf[n++] = *p;
+      p += *p == '%' ? 2 : 1;
+      continue;
+    }
+    // %[flags][width][.precision][length]conversion
+    char spec[32] = "%";
+    size_t len = 1;
+    p++;
+    while (*p && strchr("-+ #0123456789.", *p) && len < sizeof(spec) - 4)
+      spec[len++] = *p++;
+    while (*p && strchr("hlLqjzt", *p))
+      p++; // Replaced by the stored type
+    char conv = *p ? *p++ : 's';
+    if (arg >= r->count) {
+      n += snprintf(buf + n, size - n, "<missing>");
+    } else if (r->types[arg] == BINLOG_INT && strchr("dicouxX", conv)) {
+      spec[len++] = 'l';
+      spec[len++] = 'l';
+      spec[len++] = conv;
+      n += snprintf(buf + n, size - n, spec, (long long)r->values[arg].i);
+    } else if (r->types[arg] == BINLOG_DOUBLE && strchr("fFeEgGaA", conv)) {
+      spec[len++] = conv;
+      n += snprintf(buf + n, size - n, spec, r->values[arg].f);
+    } else if (r->types[arg] == BINLOG_STRING && conv == 's') {
+      spec[len++] = 's';
+      n += snprintf(buf + n, size - n, spec, r->text + r->values[arg].text);
+    } else {
+      n += snprintf(buf + n, size - n, "<bad %%%c>", conv);
+    }
+    arg++;
+    n = n < size ? n : size - 1;
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+/**
+ * Format every pending record to `fd`, merged across threads in time order.
+ * Returns the number of records written.
+ */
+static int binlogDrain(int fd) {
+  char buf[BINLOG_TEXT_SIZE + 1024];
+  int written = 0;
+  for (;;) {
+    BinlogRing *oldest = NULL;
+    const BinlogRecord *next = NULL;
+    unsigned int rings = atomic_load(&binlog.ringCount);
+    for (unsigned int t = 0; t < rings && t < BINLOG_MAX_THREADS; t++) {
+      BinlogRing *ring = atomic_load(&binlog.rings[t]);
+      if (ring == NULL)
+        continue;
+      unsigned int tail = atomic_load(&ring->tail);
+      if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+        continue;
+      const BinlogRecord *r = &ring->records[tail % BINLOG_RING_RECORDS];
+      if (next == NULL || r->ns < next->ns) {
+        oldest = ring;
+        next = r;
+      }
+    }
+    if (next == NULL)
+      return written;
+    size_t len = binlogFormat(next, oldest->tid, buf, sizeof(buf));
+    unsigned int tail = atomic_load(&oldest->tail);
+    // Lost to an overwrite while formatting without a flusher: skip it
+    if (atomic_compare_exchange_strong(&oldest->tail, &tail, tail + 1) &&
+        write(fd, buf, len) == (ssize_t)len)
+      written++;
+  }
+}
+
+static void *binlogFlusher(void *arg) {
+  (void)arg;
+  const struct timespec period = {0, BINLOG_FLUSH_MS * 1000000L};
+  while (!atomic_load(&binlog.stop)) {
+    pthread_mutex_lock(&binlog.drainLock);
+    fflush(binlog.out);
+    binlogDrain(fileno(binlog.out));
+    pthread_mutex_unlock(&binlog.drainLock);
+    nanosleep(&period, NULL);
+  }
+  return NULL;
+}
+
+static void binlogCrash(int sig) {
+  static const char banner[] = "Fatal signal, last log records:\n";
+  // Without drainLock, the crash may be in the flusher: a record it was
+  // formatting can be lost or printed twice
+  int fd = binlog.out != NULL ? fileno(binlog.out) : STDERR_FILENO;
+  if (write(fd, banner, sizeof(banner) - 1) > 0)
+    binlogDrain(fd);
+  raise(sig); // SA_RESETHAND restored the default action
+}
+
+// Start recording and print the records on a fatal signal.
+static void binlogInit(void) {
+  binlog.origin = binlogNow();
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = binlogCrash;
+  sa.sa_flags = SA_RESETHAND;
+  sigemptyset(&sa.sa_mask);
+  const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+  for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+    sigaction(signals[i], &sa, NULL);
+}
+
+/**
+ * Format the records to `out` on a background thread as they arrive.
+ * Returns -1 if the thread cannot be started.
+ */
+static int binlogStart(FILE *out) {
+  binlog.out = out;
+  atomic_store(&binlog.flushing, 1);
+  if (pthread_create(&binlog.flusher, NULL, binlogFlusher, NULL) != 0) {
+    atomic_store(&binlog.flushing, 0);
+    return -1;
+  }
+  return 0;
+}
+
+// Stop the flusher after writing what is left, and report dropped records.
+static void binlogStop(void) {
+  if (!atomic_load(&binlog.flushing))
+    return;
+  atomic_store(&binlog.stop, 1);
+  pthread_join(binlog.flusher, NULL);
+  fflush(binlog.out);
+  binlogDrain(fileno(binlog.out));
+  unsigned long long dropped = 0;
+  unsigned int rings = atomic_load(&binlog.ringCount);
+  for (unsigned int t = 0; t < rings && t < BINLOG_MAX_THREADS; t++)
+    if (atomic_load(&binlog.rings[t]) != NULL)
+      dropped += atomic_load(&atomic_load(&binlog.rings[t])->dropped);
+  if (dropped > 0)
+    fprintf(binlog.out, "Log: %llu records dropped, the flusher fell behind\n",
+            dropped);
+  if (binlog.out != stderr && binlog.out != stdout)
+    fclose(binlog.out);
+  atomic_store(&binlog.flushing, 0);
+}
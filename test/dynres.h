@@ -0,0 +1,71 @@
+/**
+ * dynres.h - Dynamic resolution controller.
+ *
+ * Holds the frame time near a budget by moving the render scale in fixed
+ * steps. The cost of a frame is assumed to follow the pixel count, i.e.
+ * scale^2: the scale goes down a step as soon as the smoothed frame time is
+ * over budget, and up a step only when the next step is predicted to fit.
+ * The first frames and the frames right after a change are not measured, they
+ * include warm-up and resize costs.
+ */
+#pragma once
+
+#define DYNRES_MIN_SCALE 0.25f
+#define DYNRES_STEP 0.125f
+#define DYNRES_SETTLE_FRAMES 3
+#define DYNRES_HEADROOM 0.9 // Scale up only if the next step fits in 90%
+
+typedef struct __DynamicResolution {
+  double targetMs; // Frame time budget, 0 disables scaling
+  float scale;     // Current render scale of both axes, (0, 1]
+  double avgMs;    // Smoothed frame time at the current scale
+  int settle;      // Frames left before the next adjustment
+  int changes;     // Number of scale changes so far
+} DynamicResolution;
+
+static void dynresInit(DynamicResolution *d, double targetMs) {
+  d->targetMs = targetMs;
+  d->scale = 1.0f;
+  d->avgMs = 0.0;
+  d->settle = DYNRES_SETTLE_FRAMES;
+  d->changes = 0;
+}
+
+/**
+ * Feed the measured time of the last frame. Returns 1 if the scale changed
+ * and the render target has to be resized.
+ */
+static int dynresUpdate(DynamicResolution *d, double frameMs) {
+  if (d->targetMs <= 0.0)
+    return 0;
+  if (d->settle > 0) {
+    d->settle--; // Not yet representative of the current size
+    return 0;
+  }
+  d->avgMs = d->avgMs > 0.0 ? d->avgMs * 0.75 + frameMs * 0.25 : frameMs;
+  float next = d->scale;
+  if (d->avgMs > d->targetMs && d->scale > DYNRES_MIN_SCALE) {
+    next = d->scale - DYNRES_STEP;
+  } else if (d->scale < 1.0f) {
+    float up = d->scale + DYNRES_STEP;
+    double predicted = d->avgMs * (up * up) / (d->scale * d->scale);
+    if (predicted < d->targetMs * DYNRES_HEADROOM)
+      next = up;
+  }
+  if (next == d->scale)
+    return 0;
+  next = next < DYNRES_MIN_SCALE ? DYNRES_MIN_SCALE : next;
+  next = next > 1.0f ? 1.0f : next;
+  d->avgMs = 0.0; // Measure the new size from scratch
+  d->scale = next;
+  d->settle = DYNRES_SETTLE_FRAMES;
+  d->changes++;
+  return 1;
+}
+
+// Size of one axis at the current scale, at least 1 pixel.
+static unsigned int dynresScaled(const DynamicResolution *d,
+                                 unsigned int size) {
+  unsigned int scaled = (unsigned int)(size * d->scale + 0.5f);
+  return scaled > 0 ? scaled : 1;
+}
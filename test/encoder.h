@@ -0,0 +1,442 @@
+/**
+ * encoder.h - A bounded pool of frame encoder threads.
+ *
+ * The render thread copies the mapped readback pixels into a pooled buffer
+ * and pushes an EncodeJob onto a lock-free MPMC ring (Vyukov style). Worker
+ * threads pop jobs and run the pool's EncodeFunc (libpng by default), so
+ * zlib never blocks the render loop unless the queue is full. A pool with a
+ * single worker encodes jobs strictly in submission order; with
+ * encoderPoolSetOrdered, frames submitted out of order by several render
+ * threads are held in a reorder window until their predecessors arrive.
+ */
+#pragma once
+#include "file.h"
+#include "trace.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <string.h>
+
+typedef struct __EncodeBuffer {
+  size_t size;
+  unsigned char *data;
+} EncodeBuffer;
+
+typedef struct __EncodeJob {
+  char *file;            // Output file, owned by the job (may be NULL)
+  int frame;             // Frame that produced the pixels
+  EncodeBuffer *buffer;  // Pixels, returned to the pool after encoding
+  unsigned int width;
+  unsigned int height;
+} EncodeJob;
+
+typedef void (*EncodeFunc)(void *user, const EncodeJob *job);
+// Told how long the EncodeFunc took for `frame`, on the worker thread.
+typedef void (*EncodeObserver)(void *user, int frame, double ms);
+
+// A bounded lock-free MPMC ring, capacity must be a power of two.
+typedef struct __JobRingSlot {
+  atomic_size_t seq;
+  void *value;
+} JobRingSlot;
+typedef struct __JobRing {
+  JobRingSlot *slots;
+  size_t mask;
+  atomic_size_t head; // next position to push
+  atomic_size_t tail; // next position to pop
+} JobRing;
+
+typedef struct __EncoderPool {
+  JobRing jobs;       // Pending EncodeJob*
+  JobRing freeBufs;   // Recycled EncodeBuffer*
+  sem_t items;        // Number of queued jobs
+  sem_t spaces;       // Free job slots, released once a job is encoded
+  pthread_t *threads;
+  int workerCount;
+  size_t capacity;
+  EncodeFunc encode;
+  void *encodeUser;
+  EncodeObserver observe; // Optional, set before the first submit
+  void *observeUser;
+  // statistics
+  atomic_size_t depth;    // Jobs queued or being encoded
+  atomic_size_t maxDepth; // High-water mark of depth
+  atomic_ullong encoded;  // Frames written
+  atomic_ullong encodeNs; // Total time spent in EncodeFunc
+  atomic_ullong submitted; // Frames submitted
+  atomic_ullong stalls;    // Submits that found the queue full
+  atomic_ullong stallNs;   // Time render threads waited for a free slot
+  // reorder window, see encoderPoolSetOrdered
+  int ordered;
+  pthread_mutex_t reorderLock;
+  pthread_cond_t reorderCond;
+  int nextFrame;         // Next frame to hand to the workers
+  EncodeJob **pending;   // Early frames, indexed by frame % window
+  size_t window;
+  size_t maxReordered;   // High-water mark of held frames
+  size_t reordered;      // Frames currently held
+  int releasing;         // A submitter is handing frames to the workers
+  int cancelled;         // Stop waiting for gaps, see encoderPoolCancel
+} EncoderPool;
+
+static size_t next_pow2(size_t v) {
+  size_t p = 1;
+  while (p < v)
+    p <<= 1;
+  return p;
+}
+
+static int jobRingInit(JobRing *ring, size_t capacity) {
+  capacity = next_pow2(capacity < 2 ? 2 : capacity);
+  ring->slots = calloc(capacity, sizeof(JobRingSlot));
+  if (!ring->slots)
+    return -1;
+  for (size_t i = 0; i < capacity; i++)
+    atomic_init(&ring->slots[i].seq, i);
+  ring->mask = capacity - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  return 0;
+}
+
+static int jobRingPush(JobRing *ring, void *value) {
+  size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  for (;;) {
+    JobRingSlot *slot = &ring->slots[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        slot->value = value;
+        atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+        return 0;
+      }
+    } else if (diff < 0) {
+      return -1; // full
+    } else {
+      pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+  }
+}
+
+static void *jobRingPop(JobRing *ring) {
+  size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  for (;;) {
+    JobRingSlot *slot = &ring->slots[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        void *value = slot->value;
+        atomic_store_explicit(&slot->seq, pos + ring->mask + 1,
+                              memory_order_release);
+        return value;
+      }
+    } else if (diff < 0) {
+      return NULL; // empty
+    } else {
+      pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+  }
+}
+
+static EncodeBuffer *encoderAcquireBuffer(EncoderPool *pool, size_t size) {
+  EncodeBuffer *buf = jobRingPop(&pool->freeBufs);
+  if (buf && buf->size != size) {
+    free(buf->data);
+    free(buf);
+    buf = NULL;
+  }
+  if (!buf) {
+    buf = malloc(sizeof(EncodeBuffer));
+    if (!buf)
+      return NULL;
+    buf->size = size;
+    buf->data = malloc(size);
+    if (!buf->data) {
+      free(buf);
+      return NULL;
+    }
+  }
+  return buf;
+}
+
+static void encoderReleaseBuffer(EncoderPool *pool, EncodeBuffer *buf) {
+  if (jobRingPush(&pool->freeBufs, buf) != 0) {
+    free(buf->data);
+    free(buf);
+  }
+}
+
+// Sample layout of PNG frames, NULL means 8-bit RGBA.
+typedef struct __PngFormat {
+  int colorType; // PNG_COLOR_TYPE_RGBA or PNG_COLOR_TYPE_GRAY
+  int bitDepth;  // 8 or 16
+} PngFormat;
+
+// EncodeFunc: write the job as a PNG file, `user` is a PngFormat or NULL.
+static void encodePng(void *user, const EncodeJob *job) {
+  static const PngFormat rgba8 = {PNG_COLOR_TYPE_RGBA, 8};
+  const PngFormat *format = user ? user : &rgba8;
+  write_linear_png(job->file, job->buffer->data, job->width, job->height,
+                   format->colorType, format->bitDepth);
+}
+
+static void *encoderWorker(void *arg) {
+  EncoderPool *pool = arg;
+  traceThreadName("encoder");
+  for (;;) {
+    while (sem_wait(&pool->items) != 0)
+      ; // EINTR
+    EncodeJob *job = jobRingPop(&pool->jobs);
+    if (!job)
+      continue; // cannot happen, a job is pushed before every post
+    if (!job->buffer) {
+      free(job); // shutdown sentinel
+      break;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t span = traceBegin();
+    pool->encode(pool->encodeUser, job);
+    traceEnd("encode", NULL, job->frame, span);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unsigned long long ns = (end.tv_sec - start.tv_sec) * 1000000000ULL +
+                            (end.tv_nsec - start.tv_nsec);
+    atomic_fetch_add(&pool->encodeNs, ns);
+    if (pool->observe)
+      pool->observe(pool->observeUser, job->frame, ns / 1e6);
+    atomic_fetch_add(&pool->encoded, 1);
+    encoderReleaseBuffer(pool, job->buffer);
+    free(job->file);
+    free(job);
+    atomic_fetch_sub(&pool->depth, 1);
+    sem_post(&pool->spaces);
+  }
+  return NULL;
+}
+
+/**
+ * Start `workers` encoder threads with at most `capacity` frames queued or
+ * in flight. `encode` (encodePng if NULL) runs on the worker threads.
+ */
+static int encoderPoolInit(EncoderPool *pool, int workers, size_t capacity,
+                           EncodeFunc encode, void *user) {
+  memset(pool, 0, sizeof(*pool));
+  pool->encode = encode ? encode : encodePng;
+  pool->encodeUser = user;
+  if (workers < 1)
+    workers = 1;
+  if (capacity < 1)
+    capacity = 1;
+  // +workers so shutdown sentinels always fit behind a full queue.
+  if (jobRingInit(&pool->jobs, capacity + workers) != 0 ||
+      jobRingInit(&pool->freeBufs, capacity + workers) != 0) {
+    printf("Failed to allocate encoder queue\n");
+    return -1;
+  }
+  sem_init(&pool->items, 0, 0);
+  sem_init(&pool->spaces, 0, capacity);
+  pool->capacity = capacity;
+  pool->threads = calloc(workers, sizeof(pthread_t));
+  for (int i = 0; i < workers; i++) {
+    if (pthread_create(&pool->threads[i], NULL, encoderWorker, pool) != 0) {
+      printf("Failed to start encoder thread %d\n", i);
+      break;
+    }
+    pool->workerCount++;
+  }
+  return pool->workerCount > 0 ? 0 : -1;
+}
+
+/**
+ * Hand jobs to the workers in frame order, starting at `firstFrame`. Frames
+ * that arrive early are held (up to `window` frames ahead); submitters of
+ * later frames block until the gap closes.
+ */
+static int encoderPoolSetOrdered(EncoderPool *pool, int firstFrame,
+                                 size_t window) {
+  pool->pending = calloc(window, sizeof(EncodeJob *));
+  if (!pool->pending)
+    return -1;
+  pthread_mutex_init(&pool->reorderLock, NULL);
+  pthread_cond_init(&pool->reorderCond, NULL);
+  pool->window = window;
+  pool->nextFrame = firstFrame;
+  pool->ordered = 1;
+  return 0;
+}
+
+// Push a job to the workers, waiting for a free slot if the queue is full.
+static void encoderEnqueue(EncoderPool *pool, EncodeJob *job) {
+  if (sem_trywait(&pool->spaces) != 0) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t span = traceBegin();
+    while (sem_wait(&pool->spaces) != 0)
+      ; // EINTR
+    traceEnd("encoder_stall", NULL, job->frame, span);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    atomic_fetch_add(&pool->stalls, 1);
+    atomic_fetch_add(&pool->stallNs,
+                     (end.tv_sec - start.tv_sec) * 1000000000ULL +
+                         (end.tv_nsec - start.tv_nsec));
+  }
+  size_t depth = atomic_fetch_add(&pool->depth, 1) + 1;
+  size_t maxDepth = atomic_load(&pool->maxDepth);
+  while (depth > maxDepth &&
+         !atomic_compare_exchange_weak(&pool->maxDepth, &maxDepth, depth))
+    ;
+  jobRingPush(&pool->jobs, job);
+  sem_post(&pool->items);
+}
+
+/**
+ * Hold `job` until its predecessors are queued. The submitter of the next
+ * frame queues it and the held frames that follow, one by one without the
+ * lock, so a full queue only blocks that submitter. Frames arriving
+ * meanwhile are held and queued by it too, keeping the order.
+ */
+static void encoderEnqueueOrdered(EncoderPool *pool, EncodeJob *job) {
+  pthread_mutex_lock(&pool->reorderLock);
+  while (!pool->cancelled &&
+         job->frame >= pool->nextFrame + (int)pool->window)
+    pthread_cond_wait(&pool->reorderCond, &pool->reorderLock);
+  if (pool->cancelled) {
+    pthread_mutex_unlock(&pool->reorderLock);
+    encoderReleaseBuffer(pool, job->buffer);
+    free(job->file);
+    free(job);
+    return;
+  }
+  if (pool->releasing || job->frame != pool->nextFrame) {
+    pool->pending[job->frame % pool->window] = job;
+    if (++pool->reordered > pool->maxReordered)
+      pool->maxReordered = pool->reordered;
+    pthread_mutex_unlock(&pool->reorderLock);
+    return;
+  }
+  // In order: release it and every held frame that directly follows it.
+  pool->releasing = 1;
+  while (job) {
+    pthread_mutex_unlock(&pool->reorderLock);
+    encoderEnqueue(pool, job); // May wait for a free slot
+    pthread_mutex_lock(&pool->reorderLock);
+    pool->nextFrame++;
+    pthread_cond_broadcast(&pool->reorderCond);
+    EncodeJob **slot = &pool->pending[pool->nextFrame % pool->window];
+    job = *slot;
+    if (job) {
+      *slot = NULL;
+      pool->reordered--;
+    }
+  }
+  pool->releasing = 0;
+  pthread_mutex_unlock(&pool->reorderLock);
+}
+
+// Drop frames that wait for a missing predecessor, e.g. when a render thread
+// failed. Frames already handed to the workers are still written.
+static void encoderPoolCancel(EncoderPool *pool) {
+  if (!pool->ordered)
+    return;
+  pthread_mutex_lock(&pool->reorderLock);
+  pool->cancelled = 1;
+  pthread_cond_broadcast(&pool->reorderCond);
+  pthread_mutex_unlock(&pool->reorderLock);
+}
+
+/**
+ * Queue `buf`, taken from encoderAcquireBuffer and filled with the pixels of
+ * `frame`, for encoding to `file`. The pool owns `buf` afterwards. Blocks
+ * only when `capacity` frames are already pending. Safe to call from several
+ * render threads.
+ */
+static int encoderSubmitBuffer(EncoderPool *pool, const char *file, int frame,
+                               EncodeBuffer *buf, unsigned int width,
+                               unsigned int height) {
+  EncodeJob *job = malloc(sizeof(EncodeJob));
+  if (!job) {
+    printf("Failed to allocate encode job\n");
+    encoderReleaseBuffer(pool, buf);
+    return -1;
+  }
+  job->file = file ? strdup(file) : NULL;
+  job->frame = frame;
+  job->buffer = buf;
+  job->width = width;
+  job->height = height;
+  atomic_fetch_add(&pool->submitted, 1);
+  if (pool->ordered)
+    encoderEnqueueOrdered(pool, job);
+  else
+    encoderEnqueue(pool, job);
+  return 0;
+}
+
+// Copy `size` bytes of `frame` pixels and queue them, see encoderSubmitBuffer.
+static int encoderSubmit(EncoderPool *pool, const char *file, int frame,
+                         const unsigned char *pixels, size_t size,
+                         unsigned int width, unsigned int height) {
+  EncodeBuffer *buf = encoderAcquireBuffer(pool, size);
+  if (!buf) {
+    printf("Failed to allocate encode buffer\n");
+    return -1;
+  }
+  memcpy(buf->data, pixels, size);
+  return encoderSubmitBuffer(pool, file, frame, buf, width, height);
+}
+
+/**
+ * Wait for every queued frame to be written, stop the workers and print the
+ * queue statistics.
+ */
+static void encoderPoolShutdown(EncoderPool *pool) {
+  if (!pool->threads)
+    return;
+  for (int i = 0; i < pool->workerCount; i++) {
+    EncodeJob *sentinel = calloc(1, sizeof(EncodeJob));
+    jobRingPush(&pool->jobs, sentinel);
+    sem_post(&pool->items);
+  }
+  for (int i = 0; i < pool->workerCount; i++)
+    pthread_join(pool->threads[i], NULL);
+  uint64_t encoded = atomic_load(&pool->encoded);
+  printf("Encoder: %d workers, queue depth %zu (max %zu), %llu/%llu frames, "
+         "%llu stalls (%.3f ms), %.3f ms/frame\n",
+         pool->workerCount, pool->capacity, atomic_load(&pool->maxDepth),
+         (unsigned long long)encoded,
+         (unsigned long long)atomic_load(&pool->submitted),
+         (unsigned long long)atomic_load(&pool->stalls),
+         atomic_load(&pool->stallNs) / 1e6,
+         encoded ? atomic_load(&pool->encodeNs) / 1e6 / encoded : 0.0);
+  if (pool->ordered) {
+    printf("Encoder: reorder window %zu, max %zu frames held\n", pool->window,
+           pool->maxReordered);
+    for (size_t i = 0; i < pool->window; i++) {
+      if (pool->pending[i]) { // Gap left by a failed render thread
+        encoderReleaseBuffer(pool, pool->pending[i]->buffer);
+        free(pool->pending[i]->file);
+        free(pool->pending[i]);
+      }
+    }
+    free(pool->pending);
+    pthread_mutex_destroy(&pool->reorderLock);
+    pthread_cond_destroy(&pool->reorderCond);
+  }
+  EncodeBuffer *buf;
+  while ((buf = jobRingPop(&pool->freeBufs)) != NULL) {
+    free(buf->data);
+    free(buf);
+  }
+  free(pool->jobs.slots);
+  free(pool->freeBufs.slots);
+  free(pool->threads);
+  sem_destroy(&pool->items);
+  sem_destroy(&pool->spaces);
+  pool->threads = NULL;
+}
@@ -1,18 +1,23 @@
+#pragma once
 #include <libpng/png.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
-#ifndef NDEBUG
-#define log(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
-#else
-#define log(fmt, ...)
-#endif
+#include "binlog.h"
 
-static void write_linear_rgba_png(png_const_charp __restrict file,
-                                  png_bytep __restrict rgba_data,
-                                  png_uint_32 width, png_uint_32 height) {
+/**
+ * Write bottom-up pixels as a linear PNG. `color_type` is PNG_COLOR_TYPE_RGBA
+ * or PNG_COLOR_TYPE_GRAY, 16-bit samples are in host (little endian) order.
+ */
+static void write_linear_png(png_const_charp __restrict file,
+                             png_bytep __restrict data, png_uint_32 width,
+                             png_uint_32 height, int color_type,
+                             int bit_depth) {
+  const size_t stride = (size_t)width *
+                        (color_type == PNG_COLOR_TYPE_RGBA ? 4 : 1) *
+                        (bit_depth / 8);
   // printf("Start writing output to %s\n", file);
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
@@ -40,17 +45,19 @@ static void write_linear_rgba_png(png_const_charp __restrict file,
 
   png_init_io(png_ptr, fp);
   png_set_compression_level(png_ptr, 6);
-  png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGBA,
+  png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth, color_type,
                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                PNG_FILTER_TYPE_DEFAULT);
   png_set_gAMA(png_ptr, info_ptr, 1.0); // Linear RGB
   png_write_info(png_ptr, info_ptr);
+  if (bit_depth == 16)
+    png_set_swap(png_ptr); // PNG samples are big endian
 
   png_bytep *row_pointers = calloc(height, sizeof(png_bytep));
 
   for (unsigned int y = 0; y < height; y++) {
     // flip the image vertically
-    row_pointers[y] = (png_bytep)rgba_data + (height - 1 - y) * width * 4;
+    row_pointers[y] = data + (height - 1 - y) * stride;
   }
 
   png_write_image(png_ptr, row_pointers);
@@ -69,6 +76,12 @@ error:
     fclose(fp);
 }
 
+static void write_linear_rgba_png(png_const_charp __restrict file,
+                                  png_bytep __restrict rgba_data,
+                                  png_uint_32 width, png_uint_32 height) {
+  write_linear_png(file, rgba_data, width, height, PNG_COLOR_TYPE_RGBA, 8);
+}
+
 static int readFile(const char *__restrict filename, char **__restrict dst, 
                     size_t *size) {
 
@@ -0,0 +1,168 @@
+/**
+ * gpuquery.h - GPU time and shader invocations of each render pass.
+ *
+ * Every pass of a frame is wrapped in a GL_TIME_ELAPSED query and, with
+ * GL_ARB_pipeline_statistics_query, in a query counting its fragment (or
+ * compute) shader invocations. llvmpipe defers rasterization until the frame
+ * is flushed, so CPU time around a draw only covers the command submission;
+ * the queries end when the rasterizer has run the pass.
+ *
+ * The queries of a frame go into one slot of a ring and are read back once
+ * they are all available, a few frames later. Nothing waits on them: when the
+ * ring is full, frames are not measured until the oldest slot completes.
+ *
+ * Include after glad/gl.h.
+ */
+#pragma once
+#include <string.h>
+
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#define GL_COMPUTE_SHADER_INVOCATIONS_ARB 0x82F5
+#endif
+
+#define PASS_QUERY_RING_SIZE 4
+#define PASS_QUERY_MAX_PASSES 8
+
+typedef struct __PassQuerySlot {
+  GLuint time[PASS_QUERY_MAX_PASSES];
+  GLuint invocations[2][PASS_QUERY_MAX_PASSES]; // Fragment, compute
+  unsigned int used;    // Bit per pass queried in this frame
+  unsigned int compute; // Bit per pass counted as compute invocations
+  int frame;
+} PassQuerySlot;
+
+typedef struct __PassStats {
+  unsigned long long frames; // Frames that ran the pass
+  double totalMs;
+  double maxMs;
+  unsigned long long invocations;
+  int compute; // Invocations are compute, not fragment, shaders
+} PassStats;
+
+typedef struct __PassQueries {
+  int passes;     // 0 when disabled
+  int statistics; // Whether invocations are counted
+  PassQuerySlot slots[PASS_QUERY_RING_SIZE];
+  int head;       // Oldest frame in flight
+  int count;      // Frames in flight
+  int recording;  // Whether the current frame has a slot
+  PassStats stats[PASS_QUERY_MAX_PASSES];
+  unsigned long long skipped; // Frames not measured, the ring was full
+} PassQueries;
+
+// Create the queries of `passes` passes. Needs a current context.
+static int passQueriesInit(PassQueries *q, int passes, int statistics) {
+  memset(q, 0, sizeof(*q));
+  if (passes > PASS_QUERY_MAX_PASSES)
+    return -1;
+  q->passes = passes;
+  q->statistics = statistics;
+  // glGenQueries: Mesa rejects the statistics targets in glCreateQueries
+  // on a 4.5 context
+  for (int s = 0; s < PASS_QUERY_RING_SIZE; s++) {
+    glGenQueries(passes, q->slots[s].time);
+    if (statistics) {
+      glGenQueries(passes, q->slots[s].invocations[0]);
+      glGenQueries(passes, q->slots[s].invocations[1]);
+    }
+  }
+  return 0;
+}
+
+static void passQueriesDestroy(PassQueries *q) {
+  for (int s = 0; q->passes > 0 && s < PASS_QUERY_RING_SIZE; s++) {
+    glDeleteQueries(q->passes, q->slots[s].time);
+    if (q->statistics) {
+      glDeleteQueries(q->passes, q->slots[s].invocations[0]);
+      glDeleteQueries(q->passes, q->slots[s].invocations[1]);
+    }
+  }
+  memset(q, 0, sizeof(*q));
+}
+
+/**
+ * Read back the oldest frame in flight once all its queries are available, or
+ * wait for them if `block`. Returns 1 and its GPU time in `frameMs` if a frame
+ * was read back.
+ */
+static int passQueriesCollect(PassQueries *q, int block, double *frameMs) {
+  if (q->count == 0)
+    return 0;
+  PassQuerySlot *slot = &q->slots[q->head];
+  int last = 31 - __builtin_clz(slot->used);
+  GLuint available = GL_FALSE;
+  if (!block)
+    glGetQueryObjectuiv(slot->time[last], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+  if (!block && !available)
+    return 0;
+  // Queries complete in order, the earlier passes are available too
+  *frameMs = 0.0;
+  for (int p = 0; p < q->passes; p++) {
+    if (!(slot->used & 1u << p))
+      continue;
+    PassStats *stats = &q->stats[p];
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(slot->time[p], GL_QUERY_RESULT, &ns);
+    double ms = ns / 1e6;
+    stats->frames++;
+    stats->totalMs += ms;
+    stats->maxMs = ms > stats->maxMs ? ms : stats->maxMs;
+    *frameMs += ms;
+    if (q->statistics) {
+      int compute = (slot->compute >> p) & 1;
+      GLuint64 invocations = 0;
+      glGetQueryObjectui64v(slot->invocations[compute][p], GL_QUERY_RESULT,
+                            &invocations);
+      stats->invocations += invocations;
+      stats->compute = compute;
+    }
+  }
+  q->head = (q->head + 1) % PASS_QUERY_RING_SIZE;
+  q->count--;
+  return 1;
+}
+
+// Start measuring `frame`, unless every slot is still in flight.
+static void passQueriesFrame(PassQueries *q, int frame) {
+  q->recording = q->passes > 0 && q->count < PASS_QUERY_RING_SIZE;
+  if (q->passes > 0 && !q->recording)
+    q->skipped++;
+  if (!q->recording)
+    return;
+  PassQuerySlot *slot = &q->slots[(q->head + q->count) % PASS_QUERY_RING_SIZE];
+  slot->used = 0;
+  slot->compute = 0;
+  slot->frame = frame;
+}
+
+static void passQueryBegin(PassQueries *q, int pass, int compute) {
+  if (!q->recording)
+    return;
+  PassQuerySlot *slot = &q->slots[(q->head + q->count) % PASS_QUERY_RING_SIZE];
+  slot->used |= 1u << pass;
+  slot->compute |= (unsigned int)(compute != 0) << pass;
+  glBeginQuery(GL_TIME_ELAPSED, slot->time[pass]);
+  if (q->statistics)
+    glBeginQuery(compute ? GL_COMPUTE_SHADER_INVOCATIONS_ARB
+                         : GL_FRAGMENT_SHADER_INVOCATIONS_ARB,
+                 slot->invocations[compute != 0][pass]);
+}
+
+static void passQueryEnd(PassQueries *q, int compute) {
+  if (!q->recording)
+    return;
+  if (q->statistics)
+    glEndQuery(compute ? GL_COMPUTE_SHADER_INVOCATIONS_ARB
+                       : GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+  glEndQuery(GL_TIME_ELAPSED);
+}
+
+// Put the queries of the frame in flight, see passQueriesCollect.
+static void passQueriesSubmit(PassQueries *q) {
+  if (q->recording &&
+      q->slots[(q->head + q->count) % PASS_QUERY_RING_SIZE].used != 0)
+    q->count++;
+  q->recording = 0;
+}
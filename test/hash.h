@@ -0,0 +1,25 @@
+/**
+ * hash.h - 64-bit FNV-1a hashing of cache keys.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Hash `size` bytes, chained through `hash`.
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+// The terminating NUL is hashed too, so "ab" + "c" differs from "a" + "bc".
+static uint64_t hashString(uint64_t hash, const char *s) {
+  return hashBytes(hash, s, strlen(s) + 1);
+}
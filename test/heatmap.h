@@ -0,0 +1,135 @@
+/**
+ * heatmap.h - False-color cost maps and per-tile cost statistics.
+ *
+ * The cost of each pixel, bottom-up as read back from GL, is mapped from
+ * black at the 1st percentile through blue, cyan, green and yellow to red at
+ * the 99th, so a few outliers do not flatten the rest of the map. Costs are
+ * also summed over HEATMAP_TILE_SIZE tiles, written as CSV and the hottest
+ * tiles printed: the regions worth optimizing, and the load balance a tiled
+ * render would get.
+ */
+#pragma once
+#include "file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEATMAP_TILE_SIZE 32
+#define HEATMAP_HOTTEST 5 // Tiles printed
+
+typedef struct __HeatmapTile {
+  int x, y; // Top-left corner, top-down like the PNG
+  int width, height;
+  double total; // Sum of the costs of its pixels
+  double max;   // Highest pixel cost
+} HeatmapTile;
+
+static int compareFloat(const void *a, const void *b) {
+  float x = *(const float *)a, y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+static int compareTileTotal(const void *a, const void *b) {
+  double x = ((const HeatmapTile *)a)->total;
+  double y = ((const HeatmapTile *)b)->total;
+  return (x < y) - (x > y); // Descending
+}
+
+// False color of `t` in [0, 1].
+static void heatmapColor(float t, unsigned char rgba[4]) {
+  static const float stops[][3] = {
+      {0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0},
+  };
+  const int last = sizeof(stops) / sizeof(stops[0]) - 1;
+  t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+  float x = t * last;
+  int i = x < last ? (int)x : last - 1;
+  float f = x - i;
+  for (int c = 0; c < 3; c++)
+    rgba[c] = (unsigned char)(255.0f *
+                              (stops[i][c] + (stops[i + 1][c] - stops[i][c]) *
+                                                 f) +
+                              0.5f);
+  rgba[3] = 255;
+}
+
+/**
+ * Write the heatmap of `cost` (`width` x `height`, bottom-up) as `<path>.png`
+ * and its per-tile statistics as `<path>.csv`, in `unit`s, and print a
+ * summary. Returns -1 if a file cannot be written.
+ */
+static int writeHeatmap(const char *path, const float *cost, int width,
+                        int height, const char *unit) {
+  const size_t pixels = (size_t)width * height;
+  const int cols = (width + HEATMAP_TILE_SIZE - 1) / HEATMAP_TILE_SIZE;
+  const int rows = (height + HEATMAP_TILE_SIZE - 1) / HEATMAP_TILE_SIZE;
+  float *sorted = malloc(pixels * sizeof(float));
+  unsigned char *image = malloc(pixels * 4);
+  HeatmapTile *tiles = calloc((size_t)cols * rows, sizeof(HeatmapTile));
+  char *file = malloc(strlen(path) + 5);
+  FILE *csv = NULL;
+  int result = -1;
+  if (sorted == NULL || image == NULL || tiles == NULL || file == NULL)
+    goto done;
+  memcpy(sorted, cost, pixels * sizeof(float));
+  qsort(sorted, pixels, sizeof(float), compareFloat);
+  float low = sorted[pixels / 100];
+  float high = sorted[pixels * 99 / 100];
+  float range = high > low ? high - low : 1.0f;
+  double total = 0.0;
+  for (int i = 0; i < cols * rows; i++) {
+    tiles[i].x = i % cols * HEATMAP_TILE_SIZE;
+    tiles[i].y = i / cols * HEATMAP_TILE_SIZE;
+    tiles[i].width = width - tiles[i].x < HEATMAP_TILE_SIZE
+                         ? width - tiles[i].x
+                         : HEATMAP_TILE_SIZE;
+    tiles[i].height = height - tiles[i].y < HEATMAP_TILE_SIZE
+                          ? height - tiles[i].y
+                          : HEATMAP_TILE_SIZE;
+  }
+  for (int row = 0; row < height; row++) {
+    int y = height - 1 - row; // Top-down
+    for (int x = 0; x < width; x++) {
+      size_t i = (size_t)row * width + x;
+      HeatmapTile *tile =
+          &tiles[y / HEATMAP_TILE_SIZE * cols + x / HEATMAP_TILE_SIZE];
+      tile->total += cost[i];
+      tile->max = cost[i] > tile->max ? cost[i] : tile->max;
+      total += cost[i];
+      heatmapColor((cost[i] - low) / range, image + i * 4);
+    }
+  }
+  sprintf(file, "%s.png", path);
+  write_linear_png(file, image, width, height, PNG_COLOR_TYPE_RGBA, 8);
+  sprintf(file, "%s.csv", path);
+  csv = fopen(file, "w");
+  if (csv == NULL) {
+    perror(file);
+    goto done;
+  }
+  fprintf(csv, "x,y,width,height,total_%s,mean_%s,max_%s\n", unit, unit,
+          unit);
+  for (int i = 0; i < cols * rows; i++)
+    fprintf(csv, "%d,%d,%d,%d,%.0f,%.2f,%.0f\n", tiles[i].x, tiles[i].y,
+            tiles[i].width, tiles[i].height, tiles[i].total,
+            tiles[i].total / (tiles[i].width * tiles[i].height),
+            tiles[i].max);
+  printf("Heatmap %s.png: %.0f %s in total, %.2f per pixel, percentiles "
+         "1/50/99 %.0f/%.0f/%.0f\n",
+         path, total, unit, total / pixels, low, sorted[pixels / 2], high);
+  qsort(tiles, (size_t)cols * rows, sizeof(HeatmapTile), compareTileTotal);
+  for (int i = 0; i < HEATMAP_HOTTEST && i < cols * rows; i++)
+    printf("  tile %4d,%4d %dx%d: %5.1f%% of the cost, %.2f %s per pixel\n",
+           tiles[i].x, tiles[i].y, tiles[i].width, tiles[i].height,
+           total > 0.0 ? 100.0 * tiles[i].total / total : 0.0,
+           tiles[i].total / (tiles[i].width * tiles[i].height), unit);
+  result = 0;
+done:
+  if (csv != NULL)
+    result = fclose(csv) == 0 ? result : -1;
+  free(sorted);
+  free(image);
+  free(tiles);
+  free(file);
+  return result;
+}
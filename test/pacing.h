@@ -0,0 +1,75 @@
+/**
+ * pacing.h - Frame pacing against a fixed frame period.
+ *
+ * Frame N is due at origin + (N - 1) * period. A frame that is ready early
+ * waits for its deadline instead of rendering as fast as possible. A frame
+ * whose slot has already passed when it would start (the next frame is due
+ * too) has missed its deadline: it renders late when catching up, or in live
+ * mode it is dropped or replaced by the previous output, so the loop never
+ * falls further behind the clock.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+typedef enum __LatePolicy {
+  LATE_RENDER,    // Render every frame, late ones as fast as possible
+  LATE_DROP,      // Live: skip late frames
+  LATE_DUPLICATE, // Live: output the previous frame again for late frames
+} LatePolicy;
+
+typedef enum __PaceAction {
+  PACE_RENDER,
+  PACE_DROP,
+  PACE_DUPLICATE,
+} PaceAction;
+
+typedef struct __FramePacer {
+  double periodMs; // 0 disables pacing
+  LatePolicy late;
+  double originMs; // Deadline of frame 1
+  uint64_t misses; // Frames that started after their slot ended
+  uint64_t drops;
+  uint64_t duplicates;
+} FramePacer;
+
+static int parseLatePolicy(const char *name, LatePolicy *late) {
+  if (strcmp(name, "drop") == 0)
+    *late = LATE_DROP;
+  else if (strcmp(name, "duplicate") == 0)
+    *late = LATE_DUPLICATE;
+  else
+    return -1;
+  return 0;
+}
+
+/**
+ * Decide what to do with `frame` at time `nowMs`. When the frame is early,
+ * `*wakeMs` is set to its deadline and the caller should sleep until then.
+ */
+static PaceAction pacerFrame(FramePacer *pacer, uint64_t frame, double nowMs,
+                             double *wakeMs) {
+  *wakeMs = 0.0;
+  if (pacer->periodMs <= 0.0)
+    return PACE_RENDER;
+  if (frame == 1)
+    pacer->originMs = nowMs;
+  double deadline = pacer->originMs + (frame - 1) * pacer->periodMs;
+  if (nowMs < deadline) {
+    *wakeMs = deadline;
+    return PACE_RENDER;
+  }
+  if (nowMs < deadline + pacer->periodMs)
+    return PACE_RENDER;
+  pacer->misses++;
+  switch (pacer->late) {
+  case LATE_DROP:
+    pacer->drops++;
+    return PACE_DROP;
+  case LATE_DUPLICATE:
+    pacer->duplicates++;
+    return PACE_DUPLICATE;
+  default:
+    return PACE_RENDER;
+  }
+}
@@ -0,0 +1,72 @@
+/**
+ * parallelcompile.h - Building several programs at once.
+ *
+ * With GL_KHR_parallel_shader_compile (or the ARB variant) the driver compiles
+ * and links on its own threads: glCompileShader and glLinkProgram return
+ * at once, and GL_COMPLETION_STATUS_KHR tells when a program can be queried
+ * without blocking. Without it, programs are built on helper threads, each
+ * with a context sharing objects with the one that uses them.
+ *
+ * glad is generated without the extension, so its enums and entry point are
+ * declared here. Include after glad/gl.h.
+ */
+#pragma once
+#include <EGL/egl.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void(GLAD_API_PTR *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+typedef struct __ParallelCompile {
+  int threads; // Programs built at once, 1 to build them one by one
+  // glMaxShaderCompilerThreadsKHR, NULL without driver support
+  PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads;
+} ParallelCompile;
+
+// Whether the current context lists the GL extension `name`.
+static int hasGlExtension(const char *name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (ext != NULL && strcmp(ext, name) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Build up to `threads` programs at once, 0 for one per CPU. Needs a current
+ * context to look up the driver's support.
+ */
+static void parallelCompileInit(ParallelCompile *pc, int threads) {
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  pc->threads = threads > 0 ? threads : 1;
+  pc->maxThreads = NULL;
+  if (hasGlExtension("GL_KHR_parallel_shader_compile"))
+    pc->maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)eglGetProcAddress(
+        "glMaxShaderCompilerThreadsKHR");
+  else if (hasGlExtension("GL_ARB_parallel_shader_compile"))
+    pc->maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)eglGetProcAddress(
+        "glMaxShaderCompilerThreadsARB");
+}
+
+// Size the driver's compiler pool of the current context, 0 disables it.
+static void parallelCompileContext(const ParallelCompile *pc) {
+  if (pc->maxThreads != NULL)
+    pc->maxThreads(pc->threads > 1 ? (GLuint)pc->threads : 0);
+}
+
+// Whether querying the link status of `prog` no longer blocks.
+static int programCompleted(const ParallelCompile *pc, GLuint prog) {
+  if (pc->maxThreads == NULL)
+    return 1;
+  GLint done = GL_TRUE;
+  glGetProgramiv(prog, GL_COMPLETION_STATUS_KHR, &done);
+  return done;
+}
@@ -0,0 +1,59 @@
+/**
+ * pixelformat.h - Render target formats selectable with --format, and how
+ * each one is read back and written out.
+ *
+ * Float and 10-bit formats are read back as 16-bit unsigned normalized, so
+ * glReadPixels does the conversion and PNG files keep the extra precision.
+ *
+ * Include after glad/gl.h.
+ */
+#pragma once
+#include <libpng/png.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef struct __PixelFormat {
+  const char *name;
+  GLenum internalFormat; // Render target storage
+  GLenum readFormat;     // glReadPixels format/type
+  GLenum readType;
+  size_t bytesPerPixel; // Of the read back pixels
+  int pngColorType;
+  int pngBitDepth;
+} PixelFormat;
+
+// clang-format off
+static const PixelFormat pixelFormats[] = {
+    {"rgba8",   GL_RGBA8,    GL_RGBA, GL_UNSIGNED_BYTE,  4, PNG_COLOR_TYPE_RGBA, 8},
+    {"rgb10a2", GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_SHORT, 8, PNG_COLOR_TYPE_RGBA, 16},
+    {"r8",      GL_R8,       GL_RED,  GL_UNSIGNED_BYTE,  1, PNG_COLOR_TYPE_GRAY, 8},
+    {"rgba16f", GL_RGBA16F,  GL_RGBA, GL_UNSIGNED_SHORT, 8, PNG_COLOR_TYPE_RGBA, 16},
+};
+// clang-format on
+
+// Look up a format by name, NULL if unknown.
+static const PixelFormat *findPixelFormat(const char *name) {
+  for (size_t i = 0; i < sizeof(pixelFormats) / sizeof(pixelFormats[0]); i++) {
+    if (strcmp(pixelFormats[i].name, name) == 0)
+      return &pixelFormats[i];
+  }
+  return NULL;
+}
+
+// GLSL image format qualifier of a render target format, NULL if unsupported.
+static const char *imageFormatQualifier(GLenum internalFormat) {
+  switch (internalFormat) {
+  case GL_RGBA8:
+    return "rgba8";
+  case GL_RGB10_A2:
+    return "rgb10_a2";
+  case GL_R8:
+    return "r8";
+  case GL_RGBA16F:
+    return "rgba16f";
+  case GL_RGBA32F:
+    return "rgba32f";
+  default:
+    return NULL;
+  }
+}
@@ -0,0 +1,164 @@
+/**
+ * readback.h - Asynchronous color buffer readback through a ring of
+ * persistently mapped pixel pack buffers.
+ *
+ * Every slot owns an immutable PBO (glBufferStorage) that stays mapped for its
+ * whole lifetime, plus a fence inserted right after the glReadPixels that
+ * filled it. Slots are consumed strictly in frame order as soon as their fence
+ * signals, so no frame is dropped and the pixels handed to the consumer always
+ * belong to the frame recorded in the slot.
+ *
+ * Include after glad/gl.h.
+ */
+#pragma once
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define READBACK_RING_SIZE 3
+#define READBACK_WAIT_TIMEOUT_NS 1000000000ULL // re-check every second
+
+// `width` x `height` is the frame size given to readbackRingInit, `size` the
+// number of bytes read back for it.
+typedef void (*ReadbackConsumer)(void *user, int frame, const void *pixels,
+                                 size_t size, unsigned int width,
+                                 unsigned int height);
+
+typedef struct __ReadbackSlot {
+  GLuint pbo;
+  void *pixels; // Persistent mapping of pbo
+  GLsync fence; // Signalled once glReadPixels into pbo has completed
+  int frame;    // Frame that produced the pixels
+} ReadbackSlot;
+
+typedef struct __ReadbackRing {
+  ReadbackSlot slots[READBACK_RING_SIZE];
+  unsigned int width;      // Frame size reported to the consumer
+  unsigned int height;
+  unsigned int readWidth;  // Region passed to glReadPixels
+  unsigned int readHeight;
+  GLenum format;
+  GLenum type;
+  size_t slotSize;
+  int head;  // Oldest in-flight slot
+  int count; // Number of in-flight slots
+  double readMs; // glReadPixels and fence of the last push
+  double waitMs; // Fence wait of the slot handed to the consumer
+} ReadbackRing;
+
+static double readbackNowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void readbackRingDestroy(ReadbackRing *ring) {
+  for (int i = 0; i < READBACK_RING_SIZE; i++) {
+    ReadbackSlot *slot = &ring->slots[i];
+    if (slot->fence)
+      glDeleteSync(slot->fence);
+    if (slot->pbo) {
+      glUnmapNamedBuffer(slot->pbo);
+      glDeleteBuffers(1, &slot->pbo);
+    }
+  }
+  memset(ring, 0, sizeof(*ring));
+}
+
+/**
+ * Create a ring for `width` x `height` frames that are read back as a
+ * `readWidth` x `readHeight` region of `format`/`type` pixels, each
+ * `bytesPerPixel` wide and tightly packed.
+ */
+static int readbackRingInit(ReadbackRing *ring, unsigned int width,
+                            unsigned int height, unsigned int readWidth,
+                            unsigned int readHeight, GLenum format,
+                            GLenum type, size_t bytesPerPixel) {
+  const GLbitfield flags =
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  memset(ring, 0, sizeof(*ring));
+  ring->width = width;
+  ring->height = height;
+  ring->readWidth = readWidth;
+  ring->readHeight = readHeight;
+  ring->format = format;
+  ring->type = type;
+  ring->slotSize = (size_t)readWidth * readHeight * bytesPerPixel;
+  for (int i = 0; i < READBACK_RING_SIZE; i++) {
+    ReadbackSlot *slot = &ring->slots[i];
+    glCreateBuffers(1, &slot->pbo);
+    glNamedBufferStorage(slot->pbo, ring->slotSize, NULL, flags);
+    slot->pixels = glMapNamedBufferRange(slot->pbo, 0, ring->slotSize, flags);
+    if (!slot->pixels) {
+      printf("Failed to map readback PBO %u\n", slot->pbo);
+      readbackRingDestroy(ring);
+      return -1;
+    }
+    slot->frame = -1;
+  }
+  return 0;
+}
+
+// Wait for the oldest in-flight slot (if `block`) and hand it to `consume`.
+// Returns 1 if a slot was consumed.
+static int readbackRingConsumeOldest(ReadbackRing *ring, int block,
+                                     ReadbackConsumer consume, void *user) {
+  if (ring->count == 0)
+    return 0;
+  ReadbackSlot *slot = &ring->slots[ring->head];
+  double start = readbackNowMs();
+  uint64_t span = traceBegin();
+  GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                   block ? READBACK_WAIT_TIMEOUT_NS : 0);
+  while (block && status == GL_TIMEOUT_EXPIRED)
+    status = glClientWaitSync(slot->fence, 0, READBACK_WAIT_TIMEOUT_NS);
+  if (status == GL_TIMEOUT_EXPIRED)
+    return 0;
+  if (status == GL_WAIT_FAILED)
+    printf("glClientWaitSync failed for frame %d\n", slot->frame);
+  glDeleteSync(slot->fence);
+  slot->fence = NULL;
+  ring->waitMs = readbackNowMs() - start;
+  traceEnd("fence_wait", NULL, slot->frame, span);
+  consume(user, slot->frame, slot->pixels, ring->slotSize, ring->width,
+          ring->height);
+  slot->frame = -1;
+  ring->head = (ring->head + 1) % READBACK_RING_SIZE;
+  ring->count--;
+  return 1;
+}
+
+/**
+ * Queue a readback of the bound read framebuffer for `frame`. Any earlier
+ * frames whose fences have already signalled are consumed first; if the ring
+ * is full, this blocks on the oldest fence.
+ */
+static void readbackRingPush(ReadbackRing *ring, int frame,
+                             ReadbackConsumer consume, void *user) {
+  while (readbackRingConsumeOldest(ring, 0, consume, user))
+    ;
+  if (ring->count == READBACK_RING_SIZE)
+    readbackRingConsumeOldest(ring, 1, consume, user);
+  int index = (ring->head + ring->count) % READBACK_RING_SIZE;
+  ReadbackSlot *slot = &ring->slots[index];
+  double start = readbackNowMs();
+  uint64_t span = traceBegin();
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, ring->readWidth, ring->readHeight, ring->format,
+               ring->type, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ring->readMs = readbackNowMs() - start;
+  traceEnd("read_pixels", NULL, frame, span);
+  slot->frame = frame;
+  ring->count++;
+}
+
+// Block until every queued frame has been consumed.
+static void readbackRingDrain(ReadbackRing *ring, ReadbackConsumer consume,
+                              void *user) {
+  while (readbackRingConsumeOldest(ring, 1, consume, user))
+    ;
+}
@@ -0,0 +1,179 @@
+/**
+ * report.h - Per-stage frame timings and the --bench JSON report.
+ *
+ * Every frame adds one sample per stage it went through; startup phases are
+ * recorded once. The report gives count, mean, p50, p95, p99 and max of each
+ * stage in milliseconds, next to the driver strings of the run, so reports
+ * from different builds and images can be compared side by side.
+ */
+#pragma once
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum __FrameStage {
+  STAGE_UNIFORMS,    // Filling and uploading the uniform block
+  STAGE_DRAW,        // Submitting the passes
+  STAGE_FLUSH,       // glFlush, or the fence wait of --target-ms
+  STAGE_READ_PIXELS, // glReadPixels into a PBO and its fence
+  STAGE_MAP,         // Fence wait and copy out of the mapped PBO
+  STAGE_ENCODE,      // Flip and PNG/stream encoding, on the encoder threads
+  STAGE_GPU,         // GPU time of the passes, from timer queries
+  STAGE_FRAME,       // Render loop iteration, from start to readback
+  STAGE_COUNT,
+} FrameStage;
+
+static const char *frameStageNames[STAGE_COUNT] = {
+    "uniforms", "draw",   "flush", "read_pixels",
+    "map",      "encode", "gpu",   "frame",
+};
+
+#define REPORT_MAX_PHASES 16
+
+typedef struct __StageSamples {
+  double *ms;
+  size_t count;
+  size_t capacity;
+} StageSamples;
+
+typedef struct __BenchReport {
+  pthread_mutex_t lock; // Samples come from render and encoder threads
+  StageSamples stages[STAGE_COUNT];
+  const char *phaseNames[REPORT_MAX_PHASES]; // Startup, in order
+  double phaseMs[REPORT_MAX_PHASES];
+  int phases;
+} BenchReport;
+
+static void benchReportInit(BenchReport *report) {
+  memset(report, 0, sizeof(*report));
+  pthread_mutex_init(&report->lock, NULL);
+}
+
+static void benchReportDestroy(BenchReport *report) {
+  for (int s = 0; s < STAGE_COUNT; s++)
+    free(report->stages[s].ms);
+  pthread_mutex_destroy(&report->lock);
+}
+
+static void benchRecord(BenchReport *report, FrameStage stage, double ms) {
+  pthread_mutex_lock(&report->lock);
+  StageSamples *samples = &report->stages[stage];
+  if (samples->count == samples->capacity) {
+    size_t capacity = samples->capacity > 0 ? samples->capacity * 2 : 256;
+    double *grown = realloc(samples->ms, capacity * sizeof(double));
+    if (grown != NULL) {
+      samples->ms = grown;
+      samples->capacity = capacity;
+    }
+  }
+  if (samples->count < samples->capacity)
+    samples->ms[samples->count++] = ms;
+  pthread_mutex_unlock(&report->lock);
+}
+
+// Add `ms` to the startup phase `name`, a string that outlives the report.
+static void benchPhase(BenchReport *report, const char *name, double ms) {
+  pthread_mutex_lock(&report->lock);
+  int i = 0;
+  while (i < report->phases && strcmp(report->phaseNames[i], name) != 0)
+    i++;
+  if (i < REPORT_MAX_PHASES) {
+    if (i == report->phases) {
+      report->phaseNames[report->phases++] = name;
+      report->phaseMs[i] = 0.0;
+    }
+    report->phaseMs[i] += ms;
+  }
+  pthread_mutex_unlock(&report->lock);
+}
+
+static int compareDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile `p` of `count` sorted samples.
+static double percentile(const double *sorted, size_t count, int p) {
+  size_t rank = (count * p + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * Copy the version that follows `tag` in `s` into `out`, up to a space, comma
+ * or parenthesis: "Mesa " of GL_VERSION or "LLVM " of the llvmpipe renderer.
+ * Empty if `s` does not name one.
+ */
+static void benchVersion(const char *s, const char *tag, char *out,
+                         size_t size) {
+  const char *v = s != NULL ? strstr(s, tag) : NULL;
+  size_t len = 0;
+  if (v != NULL) {
+    v += strlen(tag);
+    len = strcspn(v, " ,()");
+  }
+  len = len < size ? len : size - 1;
+  memcpy(out, v != NULL ? v : "", len);
+  out[len] = '\0';
+}
+
+static void writeJsonString(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; s != NULL && *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', f);
+    if ((unsigned char)*s >= 0x20)
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+/**
+ * Write the report to `path`. `info` holds key, value string pairs describing
+ * the run, terminated by a NULL key. Returns -1 if the file cannot be written.
+ */
+static int benchReportWrite(BenchReport *report, const char *path,
+                            const char *const *info) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  pthread_mutex_lock(&report->lock);
+  fprintf(f, "{\n  \"info\": {");
+  for (int i = 0; info[i] != NULL; i += 2) {
+    fprintf(f, "%s\n    ", i > 0 ? "," : "");
+    writeJsonString(f, info[i]);
+    fprintf(f, ": ");
+    writeJsonString(f, info[i + 1]);
+  }
+  fprintf(f, "\n  },\n  \"startup_ms\": {");
+  for (int i = 0; i < report->phases; i++) {
+    fprintf(f, "%s\n    ", i > 0 ? "," : "");
+    writeJsonString(f, report->phaseNames[i]);
+    fprintf(f, ": %.3f", report->phaseMs[i]);
+  }
+  fprintf(f, "\n  },\n  \"stages_ms\": {");
+  int first = 1;
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    StageSamples *samples = &report->stages[s];
+    if (samples->count == 0)
+      continue;
+    double sum = 0.0;
+    for (size_t i = 0; i < samples->count; i++)
+      sum += samples->ms[i];
+    qsort(samples->ms, samples->count, sizeof(double), compareDouble);
+    fprintf(f,
+            "%s\n    \"%s\": {\"count\": %zu, \"mean\": %.4f, \"p50\": %.4f, "
+            "\"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+            first ? "" : ",", frameStageNames[s], samples->count,
+            sum / samples->count, percentile(samples->ms, samples->count, 50),
+            percentile(samples->ms, samples->count, 95),
+            percentile(samples->ms, samples->count, 99),
+            samples->ms[samples->count - 1]);
+    first = 0;
+  }
+  fprintf(f, "\n  }\n}\n");
+  pthread_mutex_unlock(&report->lock);
+  return fclose(f) == 0 ? 0 : -1;
+}
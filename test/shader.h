@@ -22,14 +22,114 @@ void mainImage( out vec4 fragColor, in vec2 fragCoord ) {\n
 }\n
 );
 
+// Inputs of every pass. ShadertoyInputs must match ShadertoyUniforms in
+// uniforms.h.
+static const char* SHADERTOY_INPUTS = R(
+layout(std140) uniform ShadertoyInputs {
+  vec3 iResolution;
+  float iTime;
+  float iTimeDelta;
+  float iFrameRate;
+  int iFrame;
+  vec4 iMouse;
+  vec4 iDate;
+  float iChannelTime[4];
+  vec3 iChannelResolution[4];
+  vec2 iTileOffset;
+};
+uniform sampler2D iChannel0;
+uniform sampler2D iChannel1;
+uniform sampler2D iChannel2;
+uniform sampler2D iChannel3;\n
+);
+
+// Followed by SHADERTOY_INPUTS, the mainImage source and the main entry.
 static const char* FRAGMENT_SHADER_HEADER = R(#version 410 core\n
 precision highp float;\n
-uniform float iTime;
-uniform vec3 iResolution;
-uniform int iFrame;
 out vec4 fragColor;\n
 );
 
 static const char* FRAGMENT_SHADER_MAIN_ENTRY = R(
-void main() { mainImage(fragColor, gl_FragCoord.xy); }\n
+void main() { mainImage(fragColor, gl_FragCoord.xy + iTileOffset); }\n
+);
+
+// --heatmap: the Image pass timed per pixel with the shader clock, followed
+// by SHADERTOY_INPUTS like FRAGMENT_SHADER_HEADER. Renders to RGBA32F: the
+// cycles spent in mainImage, then its color so the call is not optimized out.
+static const char* PROFILE_SHADER_HEADER = R(#version 450 core\n #extension GL_ARB_shader_clock : require\n
+precision highp float;\n
+out vec4 fragColor;\n
+);
+
+static const char* PROFILE_SHADER_MAIN_ENTRY = R(
+void main() {
+  vec4 color;
+  uvec2 start = clock2x32ARB();
+  mainImage(color, gl_FragCoord.xy + iTileOffset);
+  uvec2 end = clock2x32ARB();
+  // The low words wrap around every few seconds, far above one call
+  fragColor = vec4(float(end.x - start.x), color.rgb);
+}\n
+);
+
+// Runs mainImage once per pixel of the image bound to unit 0, one invocation
+// per pixel. Follows a "#version 450" line and defines of LOCAL_SIZE_X,
+// LOCAL_SIZE_Y and OUTPUT_FORMAT, the image format qualifier of the target;
+// followed by SHADERTOY_INPUTS like FRAGMENT_SHADER_HEADER.
+static const char* COMPUTE_SHADER_HEADER = R(
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;\n
+layout(OUTPUT_FORMAT, binding = 0) writeonly uniform image2D iOutput;\n
+);
+
+static const char* COMPUTE_SHADER_MAIN_ENTRY = R(
+void main() {
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(p, imageSize(iOutput)))) {
+    return;
+  }
+  vec4 color;
+  // Same coordinate as gl_FragCoord: the pixel center
+  mainImage(color, vec2(p) + 0.5 + iTileOffset);
+  imageStore(iOutput, p, color);
+}\n
+);
+
+// Converts the RGBA render target bound to unit 0 into 8-bit 4:2:0 planes.
+// The output is a R8 target of width x (height * 3 / 2): rows [0, height) are
+// the Y plane, the remaining bytes hold U then V (I420) or interleaved UV
+// (NV12), all top-down so the readback can be written out as is.
+static const char* rgb_to_yuv_fs = R(#version 450 core\n
+layout(binding = 0) uniform sampler2D src;
+uniform ivec2 srcSize; // even width and height
+uniform int nv12;
+uniform vec3 rows[3];  // yuv = dot(rows[i], rgb) + offset[i], in code values
+uniform vec3 offset;
+out float value;
+
+vec3 load(ivec2 p) {
+    return texelFetch(src, ivec2(p.x, srcSize.y - 1 - p.y), 0).rgb;
+}
+
+void main() {
+    ivec2 o = ivec2(gl_FragCoord.xy);
+    if (o.y < srcSize.y) {
+        value = (dot(rows[0], load(o)) + offset[0]) / 255.0;
+        return;
+    }
+    int cw = srcSize.x / 2;
+    int index = (o.y - srcSize.y) * srcSize.x + o.x; // byte in chroma area
+    int comp;
+    if (nv12 != 0) {
+        comp = 1 + (index & 1);
+        index >>= 1;
+    } else {
+        int planeSize = cw * (srcSize.y / 2);
+        comp = index < planeSize ? 1 : 2;
+        index -= (comp - 1) * planeSize;
+    }
+    ivec2 p = ivec2(index % cw, index / cw) * 2;
+    vec3 rgb = 0.25 * (load(p) + load(p + ivec2(1, 0)) +
+                       load(p + ivec2(0, 1)) + load(p + ivec2(1, 1)));
+    value = (dot(rows[comp], rgb) + offset[comp]) / 255.0;
+}\n
 );
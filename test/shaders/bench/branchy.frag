@@ -0,0 +1,29 @@
+// Branchy: neighbouring pixels take different paths of unequal cost, so
+// every SIMD group of the rasterizer runs several of them.
+float hash(vec2 p) {
+  return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
+}
+
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+  vec2 uv = fragCoord / iResolution.xy;
+  float h = hash(floor(fragCoord / 2.0) + float(iFrame));
+  vec3 col = vec3(0.0);
+  if (h < 0.25) {
+    for (int i = 0; i < 64; i++) {
+      col.r += sin(uv.x * float(i) + iTime) / 64.0;
+    }
+  } else if (h < 0.5) {
+    for (int i = 0; i < 16; i++) {
+      col.g += cos(uv.y * float(i) - iTime) / 16.0;
+    }
+  } else if (h < 0.75) {
+    col.b = length(uv - 0.5);
+  } else {
+    vec2 q = uv;
+    for (int i = 0; i < 32; i++) {
+      q = abs(q) / dot(q, q) - 0.8;
+    }
+    col = vec3(q, 1.0) * 0.25;
+  }
+  fragColor = vec4(col, 1.0);
+}
@@ -0,0 +1,16 @@
+// Loop-heavy: a Mandelbrot zoom, up to 256 dependent iterations per pixel.
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+  vec2 p = (2.0 * fragCoord - iResolution.xy) / iResolution.y;
+  float zoom = exp(-0.05 * iTime);
+  vec2 c = vec2(-0.745, 0.186) + p * 1.5 * zoom;
+  vec2 z = vec2(0.0);
+  int n = 0;
+  for (; n < 256; n++) {
+    z = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y) + c;
+    if (dot(z, z) > 16.0) {
+      break;
+    }
+  }
+  float t = float(n) / 256.0;
+  fragColor = vec4(0.5 + 0.5 * cos(6.2831 * (t + vec3(0.0, 0.33, 0.67))), 1.0);
+}
@@ -0,0 +1,13 @@
+// Texture-heavy, Image: a 9x9 blur of Buffer A (iChannel0), 81 filtered
+// fetches per pixel.
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+  vec2 texel = 1.0 / iChannelResolution[0].xy;
+  vec2 uv = fragCoord / iResolution.xy;
+  vec4 sum = vec4(0.0);
+  for (int y = -4; y <= 4; y++) {
+    for (int x = -4; x <= 4; x++) {
+      sum += texture(iChannel0, uv + vec2(x, y) * texel * 1.5);
+    }
+  }
+  fragColor = vec4(sum.rgb / 81.0, 1.0);
+}
@@ -0,0 +1,13 @@
+// Texture-heavy, Buffer A: value noise read back by the Image pass.
+float hash(vec2 p) {
+  return fract(sin(dot(p, vec2(12.9898, 78.233))) * 43758.5453);
+}
+
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+  vec2 p = fragCoord / 16.0 + vec2(iTime, 0.0);
+  vec2 i = floor(p), f = fract(p);
+  vec2 u = f * f * (3.0 - 2.0 * f);
+  float n = mix(mix(hash(i), hash(i + vec2(1.0, 0.0)), u.x),
+                mix(hash(i + vec2(0.0, 1.0)), hash(i + vec2(1.0)), u.x), u.y);
+  fragColor = vec4(n, fract(n * 7.0), fract(n * 13.0), 1.0);
+}
@@ -0,0 +1,6 @@
+// Trivial: a gradient, so the frame time is the fixed cost of a pass,
+// readback and encoding.
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+  vec2 uv = fragCoord / iResolution.xy;
+  fragColor = vec4(uv, 0.5 + 0.5 * sin(iTime), 1.0);
+}
@@ -5,12 +5,36 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #define GLAD_GL_IMPLEMENTATION
+#include "dynres.h"
+#include "encoder.h"
 #include "file.h"
 #include "glad/gl.h"
+#include "heatmap.h"
+// Needs the GL declarations
+#include "binarycache.h"
+#include "gpuquery.h"
+#include "parallelcompile.h"
+#include "pacing.h"
+#include "pixelformat.h"
+#include "readback.h"
+#include "report.h"
 #include "shader.h"
+#include "sink.h"
+#include "specialize.h"
+#include "timeline.h"
+#include "trace.h"
+#include "uniforms.h"
+#include "watch.h"
+#include "workqueue.h"
+#include "yuv.h"
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -19,38 +43,289 @@ typedef struct __RenderTarget {
   GLuint width;  // Width of the texture
   GLuint height; // Height of the texture
   GLuint color0; // Texture for render target
+  GLenum format; // Internal format of color0
 } RenderTarget;
+#define RENDER_TARGET_POOL_SIZE 8
+// Released render targets, reused by passes and jobs of the same size and
+// format instead of recreating their texture and FBO
+typedef struct __RenderTargetPool {
+  RenderTarget targets[RENDER_TARGET_POOL_SIZE];
+  int count;
+  unsigned int created; // Acquisitions that had to create a target
+  unsigned int reused;  // Acquisitions served from the pool
+} RenderTargetPool;
 typedef unsigned char *PixelBuffer;
+typedef struct __FrameOutput {
+  const char *dir;      // Output directory
+  const char *name;     // File name prefix
+  EncoderPool *encoder; // PNG encoder threads
+  FrameStream *stream;  // Raw/Y4M stream instead of PNG files, or NULL
+} FrameOutput;
+typedef struct __YuvPass {
+  YuvLayout layout;       // YUV_NONE disables the conversion pass
+  YuvCoefficients coeffs; // BT.709/BT.601, limited or full range
+  GLint prog;
+  RenderTarget target; // R8, width x height * 3 / 2
+} YuvPass;
+#define MAX_CHANNELS 4
+#define MAX_PASSES 5 // Buffer A-D + Image
+#define IMAGE_PASS 4 // Index of the Image pass, buffers are 0-3
+typedef struct __GLProgram {
+  GLint id;            // OpenGL program ID
+  GLuint localSize[2]; // Compute workgroup size, 0 if rasterized
+} GLProgram;
+// A program whose link may still run in the driver, see startProgram
+typedef struct __PendingProgram {
+  GLuint prog;
+  ProgramBinaryKey binaryKey; // In the program binary cache
+  int loaded;       // Loaded from the binary cache, already linked
+  int checkCompile; // Print compile errors in release builds too
+} PendingProgram;
+// A program variant asked of cachedPrograms
+typedef struct __ProgramRequest {
+  const char *source; // mainImage source
+  GLenum format;      // Format of the target it writes
+  GLuint width;       // Size of that target, for --specialize
+  GLuint height;
+  GLint prog;         // Result, -1 if it failed to build
+  uint64_t key;       // In the ProgramCache of the context
+  char *constants;    // Constant set of the variant
+  int built;          // Not in the ProgramCache, built by this request
+  PendingProgram pending;
+} ProgramRequest;
+typedef struct __RenderPass {
+  GLProgram *prog;
+  RenderTarget *rt;
+  GLuint channels[MAX_CHANNELS]; // Textures bound to iChannel0-3
+  GLintptr uniforms;             // Offset of its inputs in the uniform buffer
+} RenderPass;
+typedef struct __GraphPass {
+  char *source;                // mainImage source, kept to build variants
+  GLProgram prog;
+  int channels[MAX_CHANNELS];  // Pass read by iChannelN, -1 if unbound
+  RenderTarget targets[2];     // targets[1] only exists for feedback buffers
+  int write;                   // Index in targets written this frame
+  int feedback;                // Read before it is written within a frame
+  int executed;                // Already written this frame
+} GraphPass;
+typedef struct __RenderGraph {
+  GraphPass passes[MAX_PASSES]; // Buffer A-D, Image; prog.id 0 if unused
+  int order[MAX_PASSES];        // Execution order
+  int count;                    // Number of passes in order
+  GLenum bufferFormat;          // GL_RGBA16F or GL_RGBA32F
+  GLuint localSize[2];          // Compute backend workgroup, 0 to rasterize
+  int specialize;               // Bake iResolution into the programs
+  const char *defines;          // --define lines, NULL if none
+  GLuint uniformBuffer;         // ShadertoyUniforms of every pass
+  GLsizeiptr uniformStride;     // Per pass, rounded to the offset alignment
+  unsigned char *uniformData;   // CPU copy uploaded once per frame
+} RenderGraph;
+// Last bound GL state, to skip redundant binds between passes
+typedef struct __GLStateCache {
+  GLuint fbo;
+  GLuint program;
+  GLuint textures[MAX_CHANNELS];
+  GLint viewport[4]; // x, y, width, height
+  GLuint uniformBuffer;
+  GLintptr uniformOffset;
+} GLStateCache;
+// --heatmap: cost of the Image pass over one frame
+typedef struct __HeatmapProfile {
+  uint64_t frame; // Frame to profile, 0 if off
+  GLint prog;     // Raster Image pass, timing itself if clock is set
+  int clock;      // Per pixel with ARB_shader_clock, else per tile
+} HeatmapProfile;
 typedef struct __RenderingContext {
   EGLDisplay eglDpy;
   EGLContext ctx;
   RenderTarget renderTarget; // Render target
-  int frameCount;            // Frame count
+  const PixelFormat *format; // Format of renderTarget and its readback
+  RenderTargetPool targetPool;
+  DynamicResolution dynres;  // Render scale for --target-ms
+  RenderTarget scaledTarget; // Rendered into and upscaled while scale < 1
+  GLsync frameFence;         // Last frame, bounds frames in flight
+  GLuint frameSize[2];       // Whole frame, renderTarget may be one tile of it
+  GLint tileOrigin[2];       // Position of renderTarget in the frame
+  RenderGraph graph;         // Buffer A-D + Image passes
+  GLStateCache state;        // Bound FBO/program/textures
+  ProgramCache programs;     // Every program variant built on this context
+  FrameTime time;            // Time inputs of the current frame
   double firstFrameTime;     // Time of the first frame
-  GLuint pbo[3];             // Pixel Buffer Objects for readback
+  ReadbackRing readback;     // Fenced PBO ring for readback
+  YuvPass yuv;               // Optional RGBA -> 4:2:0 pass before readback
+  FrameOutput *output;       // Where read back frames go
+  HeatmapProfile heatmap;    // --heatmap
+  BenchReport *report;       // --bench stage timings, or NULL
+  PassQueries queries;       // --gpu-queries, one per graph pass
 } RenderingContext;
 
-typedef struct __GLProgram {
-  GLint id; // OpenGL program ID
-  GLuint uniformLocs[16];
-} GLProgram;
-typedef struct __RenderPass {
-  GLProgram *prog;
-  RenderTarget *rt;
-} RenderPass;
+// Variants compared by --bench-*
+typedef enum __BenchMode {
+  BENCH_NONE = -1,
+  BENCH_BACKENDS,   // Raster vs compute
+  BENCH_SPECIALIZE, // Uniform vs specialized iResolution
+} BenchMode;
+// Frames shared by every render context
+typedef struct __RenderJob {
+  EGLDisplay eglDpy;
+  char *sources[MAX_PASSES];               // Loaded once, compiled per context
+  int channels[MAX_PASSES][MAX_CHANNELS];
+  GLenum bufferFormat;
+  YuvLayout yuvLayout;
+  YuvMatrix yuvMatrix;
+  int yuvFullRange;
+  FrameOutput *output;   // Shared encoder/stream, NULL to discard frames
+  uint64_t maxFrames;
+  Timeline timeline;     // Frame index to iTime
+  GLuint width;          // Frame size
+  GLuint height;
+  const PixelFormat *format; // Output render target format
+  double targetMs;           // Dynamic resolution budget, 0 if disabled
+  GLuint localSize[2];       // Compute backend workgroup, 0 to rasterize
+  int specialize;            // Bake iResolution into the programs
+  const char *defines;       // --define lines, NULL if none
+  FramePacer pacer;          // --fps-cap deadlines and live frame drops
+  struct __TileFrame *tiles; // Tiled rendering of each frame, or NULL
+  struct __HotReload *reload; // --watch rebuilds, or NULL
+  uint64_t heatmapFrame;      // --heatmap frame, 0 if off
+  BenchReport *report;        // --bench, or NULL
+  int passQueries;            // --gpu-queries
+  WorkQueue *queue;      // Frame distribution, NULL for a single context
+  atomic_ullong rendered; // Frames rendered by all contexts
+} RenderJob;
+// One EGL context rendering frames of a job on its own thread
+typedef struct __RenderWorker {
+  RenderJob *job;
+  int index;
+  GLint tile[4]; // x, y, width, height in the frame, whole frame if untiled
+  EGLContext ctx;
+  EGLSurface surface; // EGL_NO_SURFACE, or a 1x1 pbuffer without
+                      // EGL_KHR_surfaceless_context
+  pthread_t thread;
+  int result;
+  double renderMs; // From the first frame until the last one finished
+} RenderWorker;
+
+// One frame split into a grid of tiles, each context renders and reads back
+// its own tile in lockstep with the others.
+typedef struct __TileFrame {
+  int cols;
+  int rows;
+  pthread_barrier_t ready;    // Every context is set up
+  pthread_barrier_t start;    // Frame (or stop) published
+  pthread_barrier_t finished; // Every tile is in pixels
+  FrameTime time;
+  unsigned char *pixels; // Bottom-up RGBA frame the tiles are read into
+  int stop;
+} TileFrame;
 
-int exit_condition = 0;
-// Global rendering context
-RenderingContext *g_ctx = NULL;
+// One job of --batch: a shader rendered once into a tile of the atlas
+typedef struct __BatchItem {
+  char *file;  // Shader file
+  char *name;  // Output file name prefix
+  double time; // iTime
+  GLint prog;  // Owned by the program cache
+} BatchItem;
+#define BATCH_ATLAS_MAX_SIZE 2048 // Per side, bounds the readback buffers
+typedef struct __Batch {
+  BatchItem *items;
+  int count;
+  int cols; // Atlas grid, in tiles
+  int rows;
+  GLuint tileWidth; // Size of every job
+  GLuint tileHeight;
+  FrameOutput *output; // NULL to discard the frames
+} Batch;
+
+#define HOT_RELOAD_POLL_MS 100 // How often the --watch thread checks for exit
+// --watch: passes whose file changed are rebuilt on a context sharing objects
+// with the render context, then swapped in between two frames
+typedef struct __HotReload {
+  RenderJob *job;
+  const char *files[MAX_PASSES]; // Watched source of each pass, or NULL
+  FileWatch watch;
+  EGLDisplay eglDpy;
+  EGLContext ctx; // Shares objects with the render context
+  EGLSurface surface;
+  pthread_t thread;
+  atomic_int stop;
+  pthread_mutex_t lock;           // Guards the staged programs
+  GLint staged[MAX_PASSES];       // Built and not swapped in yet, 0 if none
+  char *stagedSources[MAX_PASSES];
+  uint64_t stagedKeys[MAX_PASSES]; // In the ProgramCache
+  atomic_int ready;               // Some program is staged
+  unsigned int rebuilds;          // Programs built by the thread
+  unsigned int failures;          // Edits that did not build
+  unsigned int swaps;             // Programs swapped in by the render loop
+} HotReload;
+
+atomic_int exit_condition = 0;
+// --program-cache, shared by every context
+static ProgramBinaryCache programBinaries = {.dir = NULL};
+// --compile-threads and the driver's parallel compile support
+static ParallelCompile parallelCompile = {.threads = 1};
 static void checkEglError(const char *msg);
+static int hasEglExtension(EGLDisplay dpy, const char *name);
+static EGLDisplay openEglDisplay(const char *platform, int device);
 static void checkGLError(const char *msg);
 static void checkFrameBufferStatus(const char *msg);
-void draw(RenderPass);
+void draw(RenderingContext *ctx, RenderPass);
 void clearColorBuffer(GLint buffer);
-void readbackColorBuffer(RenderTarget *rt, const char *);
-GLint compileAndLinkProgram(const char *, const char *);
+void readbackColorBuffer(RenderingContext *ctx, RenderTarget *rt);
+void finishReadback(RenderingContext *ctx);
+GLint compileAndLinkProgram(const char *, const char *, const char *);
+GLint compileAndLinkCompute(const char *, const char *, GLenum,
+                            const GLuint[2]);
+static int createRenderTarget(RenderTarget *rt, GLuint width, GLuint height,
+                              GLenum internalFormat);
+static void destroyRenderTarget(RenderingContext *ctx, RenderTarget *rt);
+static int acquireRenderTarget(RenderingContext *ctx, RenderTarget *rt,
+                               GLuint width, GLuint height,
+                               GLenum internalFormat);
+static void releaseRenderTarget(RenderingContext *ctx, RenderTarget *rt);
+static void drainRenderTargetPool(RenderingContext *ctx);
+static int applyRenderScale(RenderingContext *ctx);
+static void upscaleToOutput(RenderingContext *ctx, RenderTarget *src);
+static int prepareYuvPass(RenderingContext *ctx, YuvPass *pass,
+                          const RenderTarget *src);
+static int loadShaderSource(const char *file, char **source);
+static char *shaderName(const char *file);
+static int parsePassName(const char *name, const char **end);
+static int buildRenderGraph(RenderingContext *ctx, const RenderTarget *output);
+static void renderGraphFrame(RenderingContext *ctx, RenderTarget *output);
+static void destroyRenderGraph(RenderingContext *ctx);
 static int prepareRenderingContext(RenderingContext **ctx, EGLDisplay eglDpy,
-                                   EGLContext eglCtx, EGLSurface surface);
+                                   EGLContext eglCtx, EGLSurface surface,
+                                   GLuint width, GLuint height,
+                                   const PixelFormat *format);
+static int createEglContext(EGLDisplay eglDpy, EGLConfig eglCfg,
+                            EGLContext share, EGLContext *ctx,
+                            EGLSurface *surface);
+static void *renderWorker(void *arg);
+static void renderTileLoop(RenderWorker *worker, RenderingContext *ctx);
+static int renderTiledFrames(RenderJob *job, RenderWorker *workers);
+static int benchVariants(RenderJob *job, RenderWorker *worker, BenchMode mode,
+                         const GLuint localSize[2]);
+static int renderBatch(RenderJob *job, RenderWorker *worker, const char *list);
+static void submitFrameBuffer(FrameOutput *out, int frame, EncodeBuffer *buf,
+                              unsigned int width, unsigned int height);
+static void recordEncode(void *user, int frame, double ms);
+static void bindFramebuffer(RenderingContext *ctx, GLuint fbo);
+static void setViewportRect(RenderingContext *ctx, GLint x, GLint y,
+                            GLuint width, GLuint height);
+static void useProgram(RenderingContext *ctx, GLuint program);
+static void bindUniforms(RenderingContext *ctx, GLuint buffer,
+                         GLintptr offset);
+static void bindProgramInputs(GLint prog);
+static int cachedPrograms(RenderingContext *ctx, ProgramRequest *requests,
+                          int count);
+static int specializeRenderGraph(RenderingContext *ctx);
+static void *hotReloadThread(void *arg);
+static int prepareHeatmap(RenderingContext *ctx, uint64_t frame);
+static void profileImagePass(RenderingContext *ctx, RenderPass pass);
+static void applyHotReload(RenderingContext *ctx, HotReload *reload);
+static void printPassQueries(const PassQueries *q, int context);
+static const char *passNames[MAX_PASSES] = {"A", "B", "C", "D", "image"};
 #define NANOSECONDS_PER_SECOND 1000000000LL
 #define MILLISECONDS_PER_SECOND 1000
 /**
@@ -69,12 +344,61 @@ static double monotonic_now(void) {
   return (double)(ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec) *
          MILLISECONDS_PER_SECOND / (double)NANOSECONDS_PER_SECOND;
 }
+// Sleep until monotonic_now() reaches `deadline` (milliseconds)
+static void sleepUntil(double deadline) {
+  long long ns = (long long)(deadline * (NANOSECONDS_PER_SECOND /
+                                         MILLISECONDS_PER_SECOND));
+  struct timespec ts = {.tv_sec = ns / NANOSECONDS_PER_SECOND,
+                        .tv_nsec = ns % NANOSECONDS_PER_SECOND};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
 
 int main(int argc, char *argv[]) {
+  binlogInit();
   // Detect "--max-frames=N" from argv
   uint64_t max_frame = -1;
   const char *output_dir = NULL;
   const char *fs_file = NULL;
+  int encoder_threads = 2;
+  int encoder_queue = 8;
+  int render_threads = 1;
+  int tile_cols = 0, tile_rows = 0;
+  GLuint width = 1920, height = 1080;
+  const PixelFormat *pixel_format = findPixelFormat("rgba8");
+  double target_ms = 0.0;
+  int compute_backend = 0;
+  GLuint local_size[2] = {8, 8};
+  BenchMode bench = BENCH_NONE;
+  char *defines = NULL;
+  size_t defines_len = 0;
+  int specialize = 0;
+  const char *batch_list = NULL;
+  const char *program_cache = NULL;
+  int compile_threads = 0;
+  int watch = 0;
+  uint64_t heatmap_frame = 0;
+  const char *bench_report = NULL;
+  int gpu_queries = 0;
+  const char *trace_path = NULL;
+  const char *log_path = NULL;
+  int fps_cap = 0;
+  const char *egl_platform = NULL;
+  int egl_device = 0;
+  LatePolicy late_policy = LATE_RENDER;
+  const char *stream_path = NULL;
+  StreamFormat stream_format = STREAM_Y4M;
+  int fps = 30;
+  TimelineMode timeline_mode = TIMELINE_FIXED;
+  double start_time = 0.0;
+  const char *start_date = NULL;
+  YuvLayout yuv_layout = YUV_NONE;
+  YuvMatrix yuv_matrix = YUV_BT709;
+  int yuv_full_range = 0;
+  const char *buffer_files[IMAGE_PASS] = {NULL};
+  int channels[MAX_PASSES][MAX_CHANNELS];
+  memset(channels, -1, sizeof(channels));
+  GLenum buffer_format = GL_RGBA16F;
   for (int i = 1; i < argc; ++i) {
     if (strncmp(argv[i], "--max-frames=", 13) == 0) {
       max_frame = strtoull(argv[i] + 13, NULL, 10);
@@ -102,18 +426,441 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Fragment shader file not found: %s\n", fs_file);
         return -1;
       }
+    } else if (strncmp(argv[i], "--buffer-", 9) == 0 && argv[i][9] != '\0' &&
+               argv[i][10] == '=' && parsePassName(argv[i] + 9, NULL) >= 0 &&
+               parsePassName(argv[i] + 9, NULL) < IMAGE_PASS) {
+      // --buffer-a=file ... --buffer-d=file
+      const char *file = argv[i] + 11;
+      if (access(file, R_OK) != 0) {
+        fprintf(stderr, "Fragment shader file not found: %s\n", file);
+        return -1;
+      }
+      buffer_files[parsePassName(argv[i] + 9, NULL)] = file;
+    } else if (strncmp(argv[i], "--channel=", 10) == 0) {
+      // --channel=<pass>:<n>=<source pass>, e.g. image:0=A or A:0=A
+      const char *spec = argv[i] + 10, *end;
+      int dst = parsePassName(spec, &end);
+      int n = (dst >= 0 && *end == ':') ? end[1] - '0' : -1;
+      int src = (n >= 0 && n < MAX_CHANNELS && end[2] == '=')
+                    ? parsePassName(end + 3, &end)
+                    : -1;
+      if (src < 0 || src == IMAGE_PASS || *end != '\0') {
+        fprintf(stderr, "Invalid channel binding: %s\n", spec);
+        return -1;
+      }
+      channels[dst][n] = src;
+    } else if (strncmp(argv[i], "--buffer-format=", 16) == 0) {
+      if (strcmp(argv[i] + 16, "rgba16f") == 0) {
+        buffer_format = GL_RGBA16F;
+      } else if (strcmp(argv[i] + 16, "rgba32f") == 0) {
+        buffer_format = GL_RGBA32F;
+      } else {
+        fprintf(stderr, "Unknown buffer format: %s\n", argv[i] + 16);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--stream=", 9) == 0) {
+      stream_path = argv[i] + 9;
+    } else if (strncmp(argv[i], "--stream-format=", 16) == 0) {
+      if (parseStreamFormat(argv[i] + 16, &stream_format) != 0) {
+        fprintf(stderr, "Unknown stream format: %s\n", argv[i] + 16);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--yuv=", 6) == 0) {
+      if (parseYuvLayout(argv[i] + 6, &yuv_layout) != 0) {
+        fprintf(stderr, "Unknown YUV layout: %s\n", argv[i] + 6);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--matrix=", 9) == 0) {
+      if (parseYuvMatrix(argv[i] + 9, &yuv_matrix) != 0) {
+        fprintf(stderr, "Unknown YUV matrix: %s\n", argv[i] + 9);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--range=", 8) == 0) {
+      if (strcmp(argv[i] + 8, "full") == 0) {
+        yuv_full_range = 1;
+      } else if (strcmp(argv[i] + 8, "limited") == 0) {
+        yuv_full_range = 0;
+      } else {
+        fprintf(stderr, "Unknown YUV range: %s\n", argv[i] + 8);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--fps=", 6) == 0) {
+      fps = atoi(argv[i] + 6);
+      if (fps <= 0) {
+        fprintf(stderr, "Invalid frame rate: %s\n", argv[i] + 6);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--start-time=", 13) == 0) {
+      start_time = strtod(argv[i] + 13, NULL);
+    } else if (strncmp(argv[i], "--date=", 7) == 0) {
+      start_date = argv[i] + 7;
+    } else if (strncmp(argv[i], "--timeline=", 11) == 0) {
+      if (parseTimelineMode(argv[i] + 11, &timeline_mode) != 0) {
+        fprintf(stderr, "Unknown timeline mode: %s\n", argv[i] + 11);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--encoder-threads=", 18) == 0) {
+      encoder_threads = atoi(argv[i] + 18);
+    } else if (strncmp(argv[i], "--encoder-queue=", 16) == 0) {
+      encoder_queue = atoi(argv[i] + 16);
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      render_threads = atoi(argv[i] + 10);
+      if (render_threads <= 0) {
+        fprintf(stderr, "Invalid render thread count: %s\n", argv[i] + 10);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--size=", 7) == 0) {
+      if (sscanf(argv[i] + 7, "%ux%u", &width, &height) != 2 || width == 0 ||
+          height == 0) {
+        fprintf(stderr, "Invalid size: %s\n", argv[i] + 7);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--format=", 9) == 0) {
+      pixel_format = findPixelFormat(argv[i] + 9);
+      if (pixel_format == NULL) {
+        fprintf(stderr, "Unknown pixel format: %s\n", argv[i] + 9);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--target-ms=", 12) == 0) {
+      target_ms = strtod(argv[i] + 12, NULL);
+      if (target_ms <= 0.0) {
+        fprintf(stderr, "Invalid frame time budget: %s\n", argv[i] + 12);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--backend=", 10) == 0) {
+      if (strcmp(argv[i] + 10, "compute") == 0) {
+        compute_backend = 1;
+      } else if (strcmp(argv[i] + 10, "raster") != 0) {
+        fprintf(stderr, "Unknown backend: %s\n", argv[i] + 10);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--local-size=", 13) == 0) {
+      if (sscanf(argv[i] + 13, "%ux%u", &local_size[0], &local_size[1]) != 2 ||
+          local_size[0] == 0 || local_size[1] == 0) {
+        fprintf(stderr, "Invalid local size: %s\n", argv[i] + 13);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--program-cache=", 16) == 0) {
+      program_cache = argv[i] + 16;
+      if (mkdir(program_cache, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create program cache directory");
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--compile-threads=", 18) == 0) {
+      compile_threads = atoi(argv[i] + 18);
+      if (compile_threads <= 0) {
+        fprintf(stderr, "Invalid compile thread count: %s\n", argv[i] + 18);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+      batch_list = argv[i] + 8;
+    } else if (strcmp(argv[i], "--bench-backends") == 0) {
+      bench = BENCH_BACKENDS;
+    } else if (strcmp(argv[i], "--bench-specialize") == 0) {
+      bench = BENCH_SPECIALIZE;
+    } else if (strncmp(argv[i], "--bench=", 8) == 0) {
+      bench_report = argv[i] + 8;
+      gpu_queries = 1;
+    } else if (strcmp(argv[i], "--gpu-queries") == 0) {
+      gpu_queries = 1;
+    } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+      trace_path = argv[i] + 8;
+    } else if (strncmp(argv[i], "--log=", 6) == 0) {
+      log_path = argv[i] + 6;
+    } else if (strcmp(argv[i], "--heatmap") == 0) {
+      heatmap_frame = 1;
+    } else if (strncmp(argv[i], "--heatmap=", 10) == 0) {
+      heatmap_frame = strtoull(argv[i] + 10, NULL, 10);
+      if (heatmap_frame == 0) {
+        fprintf(stderr, "Invalid heatmap frame: %s\n", argv[i] + 10);
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--watch") == 0) {
+      watch = 1;
+    } else if (strcmp(argv[i], "--specialize") == 0) {
+      specialize = 1;
+    } else if (strncmp(argv[i], "--define=", 9) == 0) {
+      // NAME=VALUE becomes "#define NAME VALUE"
+      const char *def = argv[i] + 9;
+      const char *eq = strchr(def, '=');
+      size_t name_len = eq != NULL ? (size_t)(eq - def) : strlen(def);
+      size_t len = 10 + strlen(def);
+      char *grown = realloc(defines, defines_len + len);
+      if (name_len == 0 || grown == NULL) {
+        fprintf(stderr, "Invalid define: %s\n", def);
+        return -1;
+      }
+      defines = grown;
+      defines_len += snprintf(defines + defines_len, len, "#define %.*s %s\n",
+                              (int)name_len, def, eq != NULL ? eq + 1 : "");
+    } else if (strncmp(argv[i], "--fps-cap=", 10) == 0) {
+      fps_cap = atoi(argv[i] + 10);
+      if (fps_cap <= 0) {
+        fprintf(stderr, "Invalid frame rate cap: %s\n", argv[i] + 10);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--live=", 7) == 0) {
+      if (parseLatePolicy(argv[i] + 7, &late_policy) != 0) {
+        fprintf(stderr, "Unknown live mode: %s\n", argv[i] + 7);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--egl-platform=", 15) == 0) {
+      egl_platform = argv[i] + 15;
+    } else if (strncmp(argv[i], "--egl-device=", 13) == 0) {
+      egl_platform = "device";
+      egl_device = atoi(argv[i] + 13);
+    } else if (strncmp(argv[i], "--tiles=", 8) == 0) {
+      // --tiles=CxR, or --tiles=N for N horizontal bands
+      int n = sscanf(argv[i] + 8, "%dx%d", &tile_cols, &tile_rows);
+      if (n == 1) {
+        tile_rows = tile_cols;
+        tile_cols = 1;
+      }
+      if (n < 1 || tile_cols <= 0 || tile_rows <= 0) {
+        fprintf(stderr, "Invalid tile grid: %s\n", argv[i] + 8);
+        return -1;
+      }
     } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
       printf(
           "Usage: %s [--max-frames=N] [--output-dir=dir] [--fs=cube.frag] \n",
           argv[0]);
       printf("  --max-frames=N: Set the maximum number of frames to render.\n");
+      printf("  --egl-platform=surfaceless|device|default: EGL platform "
+             "(default: first supported of these).\n");
+      printf("  --egl-device=N: Use the N-th EGL device "
+             "(EGL_EXT_platform_device).\n");
       printf("  --fs=cube.frag: Custom fragment shader file to use.\n");
-      printf("Only support one renderpass for now.\n");
+      printf("  --size=WxH: Frame size (default 1920x1080).\n");
+      printf("  --format=rgba8|rgb10a2|r8|rgba16f: Render target format, "
+             "10-bit and float are written as 16-bit (default rgba8).\n");
+      printf("  --fps-cap=N: Render at most N frames per second.\n");
+      printf("  --live=drop|duplicate: Drop late frames, or repeat the "
+             "previous one, instead of falling behind (paces at --fps-cap, "
+             "default --fps).\n");
+      printf("  --target-ms=T: Lower the render resolution to hold T ms per "
+             "frame, upscaled to --size.\n");
+      printf("  --backend=raster|compute: Run mainImage per fragment of a "
+             "fullscreen triangle, or per invocation of a compute shader "
+             "(default raster).\n");
+      printf("  --local-size=XxY: Compute backend workgroup size (default "
+             "8x8).\n");
+      printf("  --bench-backends: Render --max-frames with each backend, "
+             "discarding the frames, and compare the frame times.\n");
+      printf("  --define=NAME=VALUE: Prepend \"#define NAME VALUE\" to every "
+             "mainImage pass.\n");
+      printf("  --specialize: Compile iResolution into the programs as a "
+             "constant, one program per size.\n");
+      printf("  --bench-specialize: Like --bench-backends, with iResolution "
+             "as a uniform and then specialized.\n");
+      printf("  --bench=report.json: Time the stages of every frame and the "
+             "startup phases, and write their mean/p50/p95/p99/max with the "
+             "driver versions.\n");
+      printf("  --gpu-queries: Measure the GPU time and shader invocations "
+             "of each pass with GL queries, printed at exit (on with "
+             "--bench).\n");
+      printf("  --trace=out.json: Record the render, readback and encode "
+             "stages of every thread and write them as Chrome trace "
+             "events.\n");
+      printf("  --log=-|FILE: Write the diagnostic log to stderr or FILE as "
+             "it is recorded (default: stderr in debug builds, otherwise "
+             "only on a crash).\n");
+      printf("  --program-cache=DIR: Store linked program binaries in DIR "
+             "and load them instead of compiling on later runs.\n");
+      printf("  --compile-threads=N: Build up to N programs at once, on the "
+             "driver's compiler threads or on helper contexts (default: one "
+             "per CPU).\n");
+      printf("  --heatmap[=N]: Write the cost of the Image pass on frame N "
+             "(default 1) as <name>_heatmap_N.png and .csv per-tile "
+             "statistics.\n");
+      printf("  --watch: Rebuild --fs and --buffer-* files when they are "
+             "saved, and swap them in without restarting.\n");
+      printf("  --batch=list.txt: Render one frame of --size per line "
+             "(\"shader.frag [iTime]\") as tiles of shared atlas targets, "
+             "written as <name>_<line>.png.\n");
+      printf("  --buffer-a=a.frag ... --buffer-d=d.frag: Shadertoy Buffer A-D "
+             "passes.\n");
+      printf("  --channel=<pass>:<n>=<src>: Bind iChannel<n> of a pass to a "
+             "buffer, e.g. image:0=A, A:0=A for feedback.\n");
+      printf("  --buffer-format=rgba16f|rgba32f: Buffer A-D texture format "
+             "(default rgba16f).\n");
+      printf("  --stream=-|path: Write frames to stdout or a FIFO instead of "
+             "PNG files.\n");
+      printf("  --stream-format=y4m|rgba: YUV4MPEG2 4:2:0 or rawvideo of the "
+             "frames as read back, RGBA or the --yuv planes (default "
+             "y4m).\n");
+      printf("  --yuv=i420|nv12: Convert to 4:2:0 on the GPU before readback "
+             "(requires --stream).\n");
+      printf("  --matrix=bt709|bt601: YUV conversion matrix (default "
+             "bt709).\n");
+      printf("  --range=limited|full: YUV output range (default limited).\n");
+      printf("  --fps=N: Frame rate of the timeline and the Y4M header "
+             "(default 30).\n");
+      printf("  --start-time=S: iTime of the first frame, in seconds "
+             "(default 0).\n");
+      printf("  --timeline=fixed|realtime: iTime from the frame index and "
+             "--fps, or from the wall clock (default fixed).\n");
+      printf("  --date=YYYY-MM-DD[THH:MM:SS]: iDate of the first frame "
+             "(default " TIMELINE_DEFAULT_DATE ", or the local time with "
+             "--timeline=realtime).\n");
+      printf("  --encoder-threads=N: PNG encoder threads (default 2).\n");
+      printf("  --encoder-queue=N: Frames queued for encoding before the "
+             "render loop stalls (default 8).\n");
+      printf("  --threads=N: Render disjoint frames on N EGL contexts in "
+             "parallel (default 1, needs --max-frames).\n");
+      printf("  --tiles=CxR|N: Split each frame into a grid of tiles (or N "
+             "bands), one EGL context per tile.\n");
       return 0;
     }
   }
+#ifndef NDEBUG
+  log_path = log_path != NULL ? log_path : "-";
+#endif
+  if (log_path != NULL) {
+    FILE *log_file = strcmp(log_path, "-") == 0 ? stderr : fopen(log_path, "w");
+    if (log_file == NULL) {
+      perror(log_path);
+      return -1;
+    }
+    if (binlogStart(log_file) != 0) {
+      fprintf(stderr, "Failed to start the log flusher\n");
+      return -1;
+    }
+    atexit(binlogStop);
+  }
+  if (stream_path != NULL && output_dir != NULL) {
+    fprintf(stderr, "--stream and --output-dir are mutually exclusive\n");
+    return -1;
+  }
+  if (yuv_layout != YUV_NONE && stream_path == NULL) {
+    fprintf(stderr, "--yuv needs --stream, PNG output is RGBA only\n");
+    return -1;
+  }
+  // iDate of the first frame: fixed unless the timeline follows the clock
+  double epoch = timelineLocalNow();
+  if ((start_date != NULL || timeline_mode == TIMELINE_FIXED) &&
+      parseTimelineDate(start_date != NULL ? start_date
+                                           : TIMELINE_DEFAULT_DATE,
+                        &epoch) != 0) {
+    fprintf(stderr, "Invalid date: %s\n", start_date);
+    return -1;
+  }
+  if (render_threads > 1 && timeline_mode == TIMELINE_REALTIME) {
+    fprintf(stderr, "--threads needs --timeline=fixed\n");
+    return -1;
+  }
+  if (stream_path != NULL && stream_format == STREAM_Y4M &&
+      yuv_layout == YUV_NONE && pixel_format->bytesPerPixel != 4) {
+    fprintf(stderr, "YUV4MPEG2 from --format=%s needs --yuv=i420 or "
+                    "--stream-format=rgba\n",
+            pixel_format->name);
+    return -1;
+  }
+  if (tile_cols > 0) {
+    int has_buffers = 0;
+    for (int p = 0; p < IMAGE_PASS; p++) {
+      has_buffers |= buffer_files[p] != NULL;
+    }
+    if (render_threads > 1 || has_buffers || yuv_layout != YUV_NONE) {
+      fprintf(stderr, "--tiles renders a single Image pass to RGBA, without "
+                      "--threads, --buffer-* or --yuv\n");
+      return -1;
+    }
+    if ((GLuint)tile_cols > width || (GLuint)tile_rows > height) {
+      fprintf(stderr, "Too many tiles for %ux%u\n", width, height);
+      return -1;
+    }
+  }
+  if (late_policy != LATE_RENDER && fps_cap == 0) {
+    fps_cap = fps; // Live frames are due at the output frame rate
+  }
+  if (fps_cap > 0 && (render_threads > 1 || tile_cols > 0)) {
+    fprintf(stderr, "--fps-cap and --live pace a single context, without "
+                    "--threads or --tiles\n");
+    return -1;
+  }
+  if (target_ms > 0.0 && (render_threads > 1 || tile_cols > 0)) {
+    fprintf(stderr, "--target-ms scales a single context, without --threads "
+                    "or --tiles\n");
+    return -1;
+  }
+  if (bench != BENCH_NONE &&
+      (max_frame == (uint64_t)-1 || render_threads > 1 || tile_cols > 0 ||
+       output_dir != NULL || stream_path != NULL || fps_cap > 0)) {
+    fprintf(stderr, "--bench-* needs --max-frames, without --threads, "
+                    "--tiles, outputs or pacing\n");
+    return -1;
+  }
+  if (batch_list != NULL) {
+    int has_buffers = 0;
+    for (int p = 0; p < IMAGE_PASS; p++) {
+      has_buffers |= buffer_files[p] != NULL;
+    }
+    if (fs_file != NULL || has_buffers || stream_path != NULL ||
+        render_threads > 1 || tile_cols > 0 || compute_backend ||
+        bench != BENCH_NONE || target_ms > 0.0 || fps_cap > 0) {
+      fprintf(stderr, "--batch renders the Image pass of each listed shader "
+                      "to PNG, without --fs, --buffer-*, --stream, --threads, "
+                      "--tiles, --backend=compute, --bench-backends, "
+                      "--target-ms or pacing\n");
+      return -1;
+    }
+  }
+  if (watch && (fs_file == NULL || render_threads > 1 || tile_cols > 0 ||
+                batch_list != NULL || bench != BENCH_NONE || specialize)) {
+    fprintf(stderr, "--watch reloads the --fs and --buffer-* files of a "
+                    "single context, without --threads, --tiles, --batch, "
+                    "--bench-* or --specialize\n");
+    return -1;
+  }
+  if (heatmap_frame > 0 &&
+      (output_dir == NULL || render_threads > 1 || tile_cols > 0 ||
+       batch_list != NULL || bench != BENCH_NONE)) {
+    fprintf(stderr, "--heatmap writes next to the frames of --output-dir on a "
+                    "single context, without --threads, --tiles, --batch or "
+                    "--bench-*\n");
+    return -1;
+  }
+  if (bench_report != NULL &&
+      (tile_cols > 0 || batch_list != NULL || bench != BENCH_NONE ||
+       heatmap_frame > 0 || watch)) {
+    fprintf(stderr, "--bench times the frames of the render loop, without "
+                    "--tiles, --batch, --bench-*, --heatmap or --watch\n");
+    return -1;
+  }
+  if (gpu_queries &&
+      (tile_cols > 0 || batch_list != NULL || bench != BENCH_NONE)) {
+    fprintf(stderr, "--gpu-queries measures the passes of the render loop, "
+                    "without --tiles, --batch or --bench-*\n");
+    return -1;
+  }
+  if (render_threads > 1 && max_frame == (uint64_t)-1) {
+    fprintf(stderr, "--threads needs --max-frames to split the frames\n");
+    return -1;
+  }
+  // Open the stream before anything is printed, so stdout can be redirected
+  FrameStream stream = {.fd = -1};
+  if (stream_path != NULL &&
+      streamOpen(&stream, stream_path, stream_format, fps, yuv_layout,
+                 yuv_matrix, yuv_full_range) != 0) {
+    return -1;
+  }
+  stream.bytesPerPixel = pixel_format->bytesPerPixel;
+  BenchReport report;
+  benchReportInit(&report);
+  if (trace_path != NULL) {
+    if (traceInit(TRACE_DEFAULT_EVENTS) != 0) {
+      printf("Failed to allocate the trace buffer\n");
+      return -1;
+    }
+    traceThreadName("main");
+  }
   // 1. Initialize EGL
-  EGLDisplay eglDpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  double startup_start = monotonic_now();
+  uint64_t span = traceBegin();
+  EGLDisplay eglDpy = openEglDisplay(egl_platform, egl_device);
+  if (eglDpy == EGL_NO_DISPLAY) {
+    return -1;
+  }
 
   EGLint major, minor;
 
@@ -129,11 +876,15 @@ int main(int argc, char *argv[]) {
   // 2. Choose an EGL configuration for OpenGL Context
   eglBindAPI(EGL_OPENGL_API); // Bind OpenGL API
 
+  const int surfaceless =
+      hasEglExtension(eglDpy, "EGL_KHR_surfaceless_context");
+  printf("EGL surfaceless context: %s\n", surfaceless ? "yes" : "no");
   const EGLint configAttribs[] = {
       EGL_RENDERABLE_TYPE,
       EGL_OPENGL_BIT, // Use OpenGL Context
       EGL_SURFACE_TYPE,
-      EGL_PBUFFER_BIT, // Use off-screen surface
+      // Off-screen surface, unless the context is made current without one
+      surfaceless ? EGL_DONT_CARE : EGL_PBUFFER_BIT,
       EGL_BLUE_SIZE,       8,  EGL_GREEN_SIZE, 8, EGL_RED_SIZE, 8,
       EGL_DEPTH_SIZE,      24, EGL_NONE,
   };
@@ -151,40 +902,37 @@ int main(int argc, char *argv[]) {
 
   // 3. Bind the OpenGL API
   eglBindAPI(EGL_OPENGL_API);
+  double phase_start = monotonic_now();
+  benchPhase(&report, "egl_init", phase_start - startup_start);
+  traceEnd("egl_init", NULL, -1, span);
+  span = traceBegin();
 
-  // 4. Create an OpenGL 4.5 core profile context.
-  // EGL_CONTEXT_MAJOR_VERSION and EGL_CONTEXT_MINOR_VERSION requires
-  // EGL_KHR_create_context extension. assume EGL_KHR_create_context is
-  // supported.
-  // clang-format off
-  const EGLint ctxAttribs[] = {
-      EGL_CONTEXT_MAJOR_VERSION,         4,
-      EGL_CONTEXT_MINOR_VERSION,         5,
-      EGL_CONTEXT_OPENGL_PROFILE_MASK,   EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
-      EGL_NONE,
-  };
-  // clang-format on
-  EGLContext ctx = eglCreateContext(eglDpy, eglCfg, EGL_NO_CONTEXT, ctxAttribs);
-  if (ctx == EGL_NO_CONTEXT) {
-    // Handle error
-    checkEglError("eglCreateContext");
-    return -1;
-  }
-
-  // 5. Create a 1x1 pbuffer surface.
-  // Pbuffer surface is an off-screen rendering surface.
-  // It's useless for render-to-texture (FBO + Texture), but some EGL
-  // implementations require it to make the OpenGL context current. See
-  // https://registry.khronos.org/EGL/extensions/KHR/EGL_KHR_surfaceless_context.txt
-  EGLint pbAttribs[] = {
-      EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
-  };
-  EGLSurface surface = eglCreatePbufferSurface(eglDpy, eglCfg, pbAttribs);
-  if (surface == EGL_NO_SURFACE) {
-    printf("failed to create pbuffer surface\n");
-    return -1;
+  // 4-5. Create one OpenGL 4.5 core profile context per render thread, or
+  // per tile
+  const int contexts = tile_cols > 0 ? tile_cols * tile_rows : render_threads;
+  RenderWorker *workers = calloc(contexts, sizeof(RenderWorker));
+  for (int w = 0; w < contexts; w++) {
+    workers[w].index = w;
+    GLint tile[4] = {0, 0, width, height};
+    if (tile_cols > 0) {
+      int c = w % tile_cols, r = w / tile_cols;
+      tile[0] = width * c / tile_cols;
+      tile[1] = height * r / tile_rows;
+      tile[2] = width * (c + 1) / tile_cols - tile[0];
+      tile[3] = height * (r + 1) / tile_rows - tile[1];
+    }
+    memcpy(workers[w].tile, tile, sizeof(tile));
+    if (createEglContext(eglDpy, eglCfg, EGL_NO_CONTEXT, &workers[w].ctx,
+                         &workers[w].surface) != 0) {
+      return -1;
+    }
   }
-  eglMakeCurrent(eglDpy, surface, surface, ctx);
+  eglMakeCurrent(eglDpy, workers[0].surface, workers[0].surface,
+                 workers[0].ctx);
+  benchPhase(&report, "create_contexts", monotonic_now() - phase_start);
+  traceEnd("create_contexts", NULL, -1, span);
+  phase_start = monotonic_now();
+  span = traceBegin();
   // Initialize GLAD to load OpenGL functions
   if (!gladLoadGL(eglGetProcAddress)) {
     printf("Failed to initialize GLAD\n");
@@ -196,227 +944,1320 @@ int main(int argc, char *argv[]) {
   printf("OpenGL shading language version: %s\n",
          glGetString(GL_SHADING_LANGUAGE_VERSION));
   assert(GLAD_GL_VERSION_4_5 == 1);
-  // prepare Rendering Context
-  if (!g_ctx && (prepareRenderingContext(&g_ctx, eglDpy, ctx, surface) != 0)) {
-    printf("Failed to prepare rendering context\n");
-    return -1;
+  if (program_cache != NULL &&
+      binaryCacheInit(&programBinaries, program_cache) != 0) {
+    printf("The driver cannot export program binaries, caching disabled\n");
   }
-  // Create OpenGL program
-  char *fs_content = NULL;
+  parallelCompileInit(&parallelCompile, compile_threads);
+  printf("Parallel shader compile: %s, %d threads\n",
+         parallelCompile.maxThreads != NULL ? "driver" : "helper contexts",
+         parallelCompile.threads);
+  benchPhase(&report, "load_gl", monotonic_now() - phase_start);
+  traceEnd("load_gl", NULL, -1, span);
+  printf("EGL/GL startup in %.3f ms\n", monotonic_now() - startup_start);
+  // Valid as long as the contexts
+  const char *gl_version = (const char *)glGetString(GL_VERSION);
+  const char *gl_vendor = (const char *)glGetString(GL_VENDOR);
+  const char *gl_renderer = (const char *)glGetString(GL_RENDERER);
+  const char *glsl_version =
+      (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION);
+
+  // Load the render graph sources: Buffer A-D + Image
+  RenderJob job = {
+      .eglDpy = eglDpy,
+      .bufferFormat = buffer_format,
+      .yuvLayout = yuv_layout,
+      .yuvMatrix = yuv_matrix,
+      .yuvFullRange = yuv_full_range,
+      .maxFrames = max_frame,
+      .timeline = {.mode = timeline_mode,
+                   .fps = fps,
+                   .startTime = start_time,
+                   .epoch = epoch - start_time},
+      .width = width,
+      .height = height,
+      .format = pixel_format,
+      .targetMs = target_ms,
+      .localSize = {compute_backend ? local_size[0] : 0,
+                    compute_backend ? local_size[1] : 0},
+      .specialize = specialize,
+      .defines = defines,
+      .heatmapFrame = heatmap_frame,
+      .report = bench_report != NULL ? &report : NULL,
+      .passQueries = gpu_queries,
+      .pacer = {.periodMs = fps_cap > 0 ? 1000.0 / fps_cap : 0.0,
+                .late = late_policy},
+  };
+  memcpy(job.channels, channels, sizeof(channels));
+  char *sources[MAX_PASSES] = {NULL};
   const char *fs_file_name = "frame";
+  for (int p = 0; p < IMAGE_PASS; p++) {
+    if (buffer_files[p] != NULL &&
+        loadShaderSource(buffer_files[p], &sources[p]) != 0) {
+      return -1;
+    }
+  }
   if (fs_file != NULL) {
     log("Using fragment shader file: %s\n", fs_file);
-    size_t len = 0;
-    if (readFile(fs_file, &fs_content, &len) != 0) {
-      log("Failed to read fragment shader file: %s\n", fs_file);
+    if (loadShaderSource(fs_file, &sources[IMAGE_PASS]) != 0) {
+      return -1;
+    }
+    fs_file_name = shaderName(fs_file);
+  } else {
+    sources[IMAGE_PASS] = strdup(basic_fs);
+  }
+  memcpy(job.sources, sources, sizeof(sources));
+
+  EncoderPool encoder = {0};
+  PngFormat png_format = {.colorType = pixel_format->pngColorType,
+                          .bitDepth = pixel_format->pngBitDepth};
+  FrameOutput output = {
+      .dir = output_dir,
+      .name = fs_file_name,
+      .encoder = &encoder,
+      .stream = stream_path != NULL ? &stream : NULL,
+  };
+  if (output.stream != NULL) {
+    // A single worker keeps the stream in frame order, the reorder window
+    // absorbs frames finishing out of order on parallel render threads. A
+    // single context submits in order, and may skip dropped frames.
+    if (encoderPoolInit(&encoder, 1, encoder_queue, streamEncode, &stream) !=
+            0 ||
+        (render_threads > 1 &&
+         encoderPoolSetOrdered(&encoder, 1,
+                               encoder_queue > 2 * render_threads
+                                   ? encoder_queue
+                                   : 2 * render_threads) != 0)) {
+      printf("Failed to start stream writer thread\n");
       return -1;
     }
-    if (strstr(fs_content, "void mainImage") == NULL) {
-      printf("Fragment shader file does not contain 'void mainImage'\n");
-      free(fs_content);
+    job.output = &output;
+  } else if (output_dir != NULL) {
+    if (encoderPoolInit(&encoder, encoder_threads, encoder_queue, encodePng,
+                        &png_format) != 0) {
+      printf("Failed to start PNG encoder threads\n");
       return -1;
     }
-    fs_file_name = strrchr(fs_file, '/');
-    if (fs_file_name == NULL) {
-      fs_file_name = fs_file; // No directory, use the whole file name
-    } else {
-      fs_file_name++; // Skip the directory part
+    job.output = &output;
+  }
+  if (job.report != NULL) {
+    encoder.observe = recordEncode;
+    encoder.observeUser = job.report;
+  }
+
+  WorkQueue queue = {0};
+  if (render_threads > 1) {
+    if (workQueueInit(&queue, render_threads, 1, max_frame) != 0) {
+      printf("Failed to create frame queue\n");
+      return -1;
     }
-    const char *ext = strchr(fs_file_name, '.');
-    if (ext != NULL) {
-      fs_file_name = strndup(fs_file_name, ext - fs_file_name);
+    job.queue = &queue;
+  }
+  TileFrame tiles = {.cols = tile_cols, .rows = tile_rows};
+  if (tile_cols > 0) {
+    pthread_barrier_init(&tiles.ready, NULL, contexts + 1);
+    pthread_barrier_init(&tiles.start, NULL, contexts + 1);
+    pthread_barrier_init(&tiles.finished, NULL, contexts + 1);
+    job.tiles = &tiles;
+  }
+  HotReload reload = {.job = &job, .eglDpy = eglDpy};
+  if (watch) {
+    memcpy(reload.files, buffer_files, sizeof(buffer_files));
+    reload.files[IMAGE_PASS] = fs_file;
+    pthread_mutex_init(&reload.lock, NULL);
+    if (fileWatchInit(&reload.watch, reload.files, MAX_PASSES) != 0 ||
+        createEglContext(eglDpy, eglCfg, workers[0].ctx, &reload.ctx,
+                         &reload.surface) != 0 ||
+        pthread_create(&reload.thread, NULL, hotReloadThread, &reload) != 0) {
+      printf("Failed to start watching the shader files\n");
+      return -1;
     }
+    job.reload = &reload;
+    printf("Watching %s and its buffers for changes\n", fs_file);
+  }
+  log("Starting render loop...\n");
+  double render_start = monotonic_now();
+  int result = 0;
+  if (batch_list != NULL) {
+    workers[0].job = &job;
+    result = renderBatch(&job, &workers[0], batch_list);
+  } else if (bench != BENCH_NONE) {
+    result = benchVariants(&job, &workers[0], bench, local_size);
+  } else if (contexts == 1 && job.tiles == NULL) {
+    // Render on this thread, the context is already current
+    workers[0].job = &job;
+    renderWorker(&workers[0]);
   } else {
-    fs_content = strdup(basic_fs);
+    eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    for (int w = 0; w < contexts; w++) {
+      workers[w].job = &job;
+      if (pthread_create(&workers[w].thread, NULL, renderWorker,
+                         &workers[w]) != 0) {
+        printf("Failed to start render thread %d\n", w);
+        return -1;
+      }
+    }
+    if (job.tiles != NULL) {
+      result = renderTiledFrames(&job, workers);
+    }
+    for (int w = 0; w < contexts; w++) {
+      pthread_join(workers[w].thread, NULL);
+    }
   }
-
-  GLint prog = compileAndLinkProgram(fullscreen_tri_vs, fs_content);
-  free(fs_content);
-  if (prog < 0) {
-    printf("Failed to compile and link OpenGL program\n");
-    return -1;
+  if (job.tiles != NULL) {
+    pthread_barrier_destroy(&tiles.ready);
+    pthread_barrier_destroy(&tiles.start);
+    pthread_barrier_destroy(&tiles.finished);
+  } else if (render_threads > 1) {
+    double seconds = (monotonic_now() - render_start) / 1000.0;
+    printf("Render threads: %d contexts, %llu frames in %.3f seconds "
+           "(%.3f FPS), %llu steals\n",
+           render_threads, (unsigned long long)atomic_load(&job.rendered),
+           seconds, atomic_load(&job.rendered) / seconds,
+           (unsigned long long)atomic_load(&queue.steals));
+    workQueueDestroy(&queue);
+  }
+  if (job.reload != NULL) {
+    atomic_store(&reload.stop, 1);
+    pthread_join(reload.thread, NULL);
+    printf("Hot reload: %u rebuilt, %u failed, %u swapped in\n",
+           reload.rebuilds, reload.failures, reload.swaps);
+    for (int p = 0; p < MAX_PASSES; p++) {
+      free(reload.stagedSources[p]); // Programs go with the shared objects
+    }
+    fileWatchDestroy(&reload.watch);
+    pthread_mutex_destroy(&reload.lock);
+    if (reload.surface != EGL_NO_SURFACE) {
+      eglDestroySurface(eglDpy, reload.surface);
+    }
+    eglDestroyContext(eglDpy, reload.ctx);
+  }
+  for (int w = 0; w < contexts; w++) {
+    result = workers[w].result != 0 ? -1 : result;
   }
-  GLProgram glProg = {
-      .id = prog,
-      .uniformLocs = {glGetUniformLocation(prog, "iTime"),
-                      glGetUniformLocation(prog, "iResolution"),
-                      glGetUniformLocation(prog, "iFrame")},
-  };
-  static int vertAttrPosition = 0;
-  static const GLfloat vertices[] = {
-      -1.0f, -1.0f, 1.0f, 3.0f, -1.0f, 1.0f, -1.0f, 3.0f, 1.0f,
-  };
-  GLuint vao;
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(vertAttrPosition, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-  glEnableVertexAttribArray(vertAttrPosition);
-
-  log("OpenGL program created with ID: %d\n", prog);
-  log("rt.fbo = %u, rt.width = %u, rt.height = %u\n", g_ctx->renderTarget.fbo,
-      g_ctx->renderTarget.width, g_ctx->renderTarget.height);
-  RenderPass pass = {
-      .prog = &glProg,
-      .rt = &g_ctx->renderTarget,
-  };
-  // render loop here
-  glBindVertexArray(vao);
 
-  double T0 = 0.0;
-  int FpsCounter = 0;
-  g_ctx->frameCount = 0;
-  log("Starting render loop...\n");
-  while (!exit_condition &&
-         (max_frame == -1 || g_ctx->frameCount < max_frame)) {
-    g_ctx->frameCount++;
-    // 6. Render with OpenGL context to the FBO + Texture
-    double start = monotonic_now();
-    if (g_ctx->frameCount == 1) {
-      g_ctx->firstFrameTime = T0 = start;
-    }
-    draw(pass);
-    glFlush();
-    // commit render buffer, useless for Pbuffer surface
-    eglSwapBuffers(eglDpy, surface);
-    FpsCounter++;
-    double end = monotonic_now();
-    if (end - T0 >= 5000.0) { // 5 seconds
-      float seconds = (float)(end - T0) / 1000.0f;
-      float fps = (float)FpsCounter / seconds;
-      printf("%d frames in %6.3f seconds : %6.3f FPS\n", FpsCounter, seconds,
-             fps);
-      fflush(stdout);
-      T0 = end;
-      FpsCounter = 0; // Reset
-    }
-    if (output_dir != NULL) {
-      const size_t filename_len =
-          20 + strlen(output_dir) + strlen(fs_file_name);
-      char *output_file = calloc(filename_len, sizeof(char));
-      snprintf(output_file, filename_len - 1, "%s/%s_%04d.png", output_dir,
-               fs_file_name, g_ctx->frameCount - 2);
-      readbackColorBuffer(pass.rt, output_file);
-      free(output_file);
-    }
-  }
-
-  // Cleanup OpenGL resources
-  log("Cleaning up OpenGL resources...\n");
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glDeleteVertexArrays(1, &vao);
-  glDeleteBuffers(1, &vbo);
-  glDeleteFramebuffers(1, &g_ctx->renderTarget.fbo);
-  glDeleteTextures(1, &g_ctx->renderTarget.color0);
-  glDeleteBuffers(sizeof(g_ctx->pbo) / sizeof(g_ctx->pbo[0]), g_ctx->pbo);
-  glDeleteProgram(glProg.id);
-  glFinish();
-  free(g_ctx);
-  g_ctx = NULL;
+  // Flush pending PNG writes
+  encoderPoolShutdown(&encoder);
+  if (job.report != NULL) {
+    char mesa[64], llvm[64], size[32], frames[32], threads[16];
+    benchVersion(gl_version, "Mesa ", mesa, sizeof(mesa));
+    benchVersion(gl_renderer, "LLVM ", llvm, sizeof(llvm));
+    snprintf(size, sizeof(size), "%ux%u", width, height);
+    snprintf(frames, sizeof(frames), "%llu",
+             (unsigned long long)atomic_load(&job.rendered));
+    snprintf(threads, sizeof(threads), "%d", render_threads);
+    const char *info[] = {
+        "gl_version", gl_version,
+        "gl_vendor", gl_vendor,
+        "gl_renderer", gl_renderer,
+        "glsl_version", glsl_version,
+        "mesa_version", mesa,
+        "llvm_version", llvm,
+        "shader", fs_file != NULL ? fs_file : "(built-in)",
+        "size", size,
+        "format", pixel_format->name,
+        "backend", compute_backend ? "compute" : "raster",
+        "output", stream_path != NULL ? "stream"
+                  : output_dir != NULL ? "png" : "none",
+        "render_threads", threads,
+        "frames", frames,
+        NULL,
+    };
+    if (benchReportWrite(&report, bench_report, info) == 0) {
+      printf("Wrote the frame stage report to %s\n", bench_report);
+    } else {
+      result = -1;
+    }
+  }
+  benchReportDestroy(&report);
+  if (trace_path != NULL) {
+    result = traceWrite(trace_path) == 0 ? result : -1;
+    traceDestroy();
+  }
+  if (stream_path != NULL) {
+    printf("Streamed %llu frames to %s\n", (unsigned long long)stream.frames,
+           stream_path);
+    streamClose(&stream);
+  }
+  for (int p = 0; p < MAX_PASSES; p++) {
+    free(sources[p]);
+  }
+  free(defines);
+  if (programBinaries.dir != NULL) {
+    printf("Program binary cache: %llu hits, %llu misses, %llu stored\n",
+           (unsigned long long)atomic_load(&programBinaries.hits),
+           (unsigned long long)atomic_load(&programBinaries.misses),
+           (unsigned long long)atomic_load(&programBinaries.stores));
+  }
 
   // 7. Terminate EGL when finished
   eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-  eglDestroySurface(eglDpy, surface);
-  eglDestroyContext(eglDpy, ctx);
+  for (int w = 0; w < contexts; w++) {
+    if (workers[w].surface != EGL_NO_SURFACE) {
+      eglDestroySurface(eglDpy, workers[w].surface);
+    }
+    eglDestroyContext(eglDpy, workers[w].ctx);
+  }
+  free(workers);
   eglTerminate(eglDpy);
-  return 0;
-}
-
-void clearColorBuffer(GLint buffer) {
-  static const GLfloat learColor[] = {0.f, 0.f, 0.f, 1.0f};
-  glClearBufferfv(GL_COLOR, buffer, learColor);
-  // old way to clear color
-  // glClearColor(learColor[0], learColor[1], learColor[2], learColor[3]);
-  // glClear(GL_COLOR_BUFFER_BIT);
+  return result;
 }
 
-void draw(RenderPass pass) {
-  assert(g_ctx != NULL);
-  // begin renderpass
-  float now =
-      (monotonic_now() - g_ctx->firstFrameTime) / 1000.0f; // in milliseconds
-  log("Draw iTime = %.3f, iFrame=%d\n", now, g_ctx->frameCount);
-  glBindFramebuffer(GL_FRAMEBUFFER, pass.rt->fbo);
-  checkFrameBufferStatus("Before clearing");
-  glViewport(0, 0, pass.rt->width, pass.rt->height);
-  clearColorBuffer(0);
-  glUseProgram(pass.prog->id);
-  checkGLError("Before drawing");
-  // iTime and iResolution uniforms
-  if (pass.prog->uniformLocs[0] != -1)
-    glUniform1f(pass.prog->uniformLocs[0], now);
-  if (pass.prog->uniformLocs[1] != -1)
-    glUniform3f(pass.prog->uniformLocs[1], pass.rt->width, pass.rt->height,
-                1.0f);
-  if (pass.prog->uniformLocs[2] != -1)
-    glUniform1i(pass.prog->uniformLocs[2], g_ctx->frameCount);
-  checkGLError("After setting uniforms");
-  glDrawArrays(GL_TRIANGLES, 0, 3);
-  checkGLError("After drawing");
+// Whether `name` is in the extension string of `dpy` (EGL_NO_DISPLAY: client
+// extensions).
+static int hasEglExtension(EGLDisplay dpy, const char *name) {
+  const char *exts = eglQueryString(dpy, EGL_EXTENSIONS);
+  size_t len = strlen(name);
+  for (const char *p = exts; p != NULL && (p = strstr(p, name)) != NULL;
+       p += len) {
+    if ((p == exts || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+      return 1;
+    }
+  }
+  return 0;
 }
 
-void readbackColorBuffer(RenderTarget *rt, const char *output_file) {
-#ifndef NDEBUG
-  printf("Read back color buffer from RT %u using PBO...\n", rt->fbo);
-#endif
-  glBindFramebuffer(GL_FRAMEBUFFER, rt->fbo);
-  unsigned int width = rt->width, height = rt->height;
-  size_t dataSize = width * height * 4 * sizeof(GLubyte);
-  int pbo_count = sizeof(g_ctx->pbo) / sizeof(g_ctx->pbo[0]);
-  if (g_ctx->pbo[0] == 0) {
-    glGenBuffers(pbo_count, &g_ctx->pbo[0]);
-  }
-  int index = g_ctx->frameCount % pbo_count; // Use ping-pong PBOs
-  GLuint pbo = g_ctx->pbo[index];
-  // printf("Using PBO %u for glReadPixels\n", pbo);
-  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
-  glBufferData(GL_PIXEL_PACK_BUFFER, dataSize, NULL, GL_STREAM_READ);
-  checkGLError("After glBindBuffer and glBufferData");
-  // Read pixels into the PBO
-  double read_start = monotonic_now();
-  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-  checkGLError("After glReadPixels with PBO");
-  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); // Unbind PBO
-  log("glReadPixels in %.3f ms\n", (double)(monotonic_now() - read_start));
-  if (g_ctx->frameCount < pbo_count) {
-#ifndef NDEBUG
-    printf("Skipping glMapBuffer for first %d frames\n", pbo_count - 1);
-#endif
-    return; // Skip mapping for the first few frames
-  }
-  int prev = (index + 1) % pbo_count; // Previous PBO for readback
-  pbo = g_ctx->pbo[prev];
-  log("Using PBO %u for glMapBuffer\n", pbo);
-  // Map the PBO to client memory
-  // OpenGL 4.5 allows glMapNamedBuffer
-  GLubyte *const pixels = (GLubyte *)glMapNamedBuffer(pbo, GL_READ_ONLY);
-  if (!pixels) {
-    printf("Failed to map PBO for pixel readback\n");
-    return;
+/**
+ * Open an EGL display without a window system. `platform` is "surfaceless"
+ * (EGL_MESA_platform_surfaceless), "device" (EGL_EXT_platform_device, the
+ * `device`-th device) or "default" for eglGetDisplay(EGL_DEFAULT_DISPLAY).
+ * NULL picks surfaceless, then device, then default, whichever the client
+ * extensions support.
+ */
+static EGLDisplay openEglDisplay(const char *platform, int device) {
+  if (platform == NULL) {
+    platform = hasEglExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")
+                   ? "surfaceless"
+               : hasEglExtension(EGL_NO_DISPLAY, "EGL_EXT_platform_device")
+                   ? "device"
+                   : "default";
+  }
+  printf("EGL platform: %s\n", platform);
+  EGLDisplay dpy = EGL_NO_DISPLAY;
+  if (strcmp(platform, "surfaceless") == 0) {
+    dpy = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                EGL_DEFAULT_DISPLAY, NULL);
+  } else if (strcmp(platform, "device") == 0) {
+    PFNEGLQUERYDEVICESEXTPROC queryDevices =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    EGLDeviceEXT devices[16];
+    EGLint count = 0;
+    if (queryDevices == NULL || !queryDevices(16, devices, &count)) {
+      checkEglError("eglQueryDevicesEXT");
+      return EGL_NO_DISPLAY;
+    }
+    if (device < 0 || device >= count) {
+      printf("EGL device %d not found, %d available\n", device, count);
+      return EGL_NO_DISPLAY;
+    }
+    PFNEGLQUERYDEVICESTRINGEXTPROC queryDeviceString =
+        (PFNEGLQUERYDEVICESTRINGEXTPROC)eglGetProcAddress(
+            "eglQueryDeviceStringEXT");
+    const char *file =
+        queryDeviceString != NULL
+            ? queryDeviceString(devices[device], EGL_DRM_DEVICE_FILE_EXT)
+            : NULL;
+    printf("EGL device %d/%d: %s\n", device, count,
+           file != NULL ? file : "(software)");
+    dpy = eglGetPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[device],
+                                NULL);
+  } else if (strcmp(platform, "default") == 0) {
+    dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  } else {
+    printf("Unknown EGL platform: %s\n", platform);
+    return EGL_NO_DISPLAY;
   }
-  checkGLError("After glMapNamedBuffer");
-  // Write the pixels to a PNG file
-  write_linear_rgba_png(output_file, pixels, width, height);
-  glUnmapNamedBuffer(pbo);
+  if (dpy == EGL_NO_DISPLAY) {
+    checkEglError("eglGetPlatformDisplay");
+  }
+  return dpy;
 }
 
-static void compileShader(GLuint *shader, GLenum type, const char **source,
-                          GLsizei shader_count, GLint *shader_lengths) {
-  *shader = glCreateShader(type);
-  if (*shader == 0) {
-    printf("Failed to create shader of type %d\n", type);
-    return;
-  }
-  glShaderSource(*shader, shader_count, source, shader_lengths);
-  glCompileShader(*shader);
-#ifndef NDEBUG
-  GLint compileStatus;
-  glGetShaderiv(*shader, GL_COMPILE_STATUS, &compileStatus);
-  if (compileStatus == GL_FALSE) {
-    GLint logLength;
+/**
+ * Create an OpenGL 4.5 core profile context sharing objects with `share`
+ * (EGL_NO_CONTEXT for none). Unless the display supports
+ * EGL_KHR_surfaceless_context, `*surface` is a 1x1 pbuffer to make it current.
+ */
+static int createEglContext(EGLDisplay eglDpy, EGLConfig eglCfg,
+                            EGLContext share, EGLContext *ctx,
+                            EGLSurface *surface) {
+  // EGL_CONTEXT_MAJOR_VERSION and EGL_CONTEXT_MINOR_VERSION requires
+  // EGL_KHR_create_context extension. assume EGL_KHR_create_context is
+  // supported.
+  // clang-format off
+  const EGLint ctxAttribs[] = {
+      EGL_CONTEXT_MAJOR_VERSION,         4,
+      EGL_CONTEXT_MINOR_VERSION,         5,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK,   EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE,
+  };
+  // clang-format on
+  *ctx = eglCreateContext(eglDpy, eglCfg, share, ctxAttribs);
+  if (*ctx == EGL_NO_CONTEXT) {
+    // Handle error
+    checkEglError("eglCreateContext");
+    return -1;
+  }
+
+  *surface = EGL_NO_SURFACE;
+  if (hasEglExtension(eglDpy, "EGL_KHR_surfaceless_context")) {
+    return 0; // Render-to-texture only, no surface needed
+  }
+  // Pbuffer surface is an off-screen rendering surface.
+  // It's useless for render-to-texture (FBO + Texture), but some EGL
+  // implementations require it to make the OpenGL context current. See
+  // https://registry.khronos.org/EGL/extensions/KHR/EGL_KHR_surfaceless_context.txt
+  EGLint pbAttribs[] = {
+      EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
+  };
+  *surface = eglCreatePbufferSurface(eglDpy, eglCfg, pbAttribs);
+  if (*surface == EGL_NO_SURFACE) {
+    printf("failed to create pbuffer surface\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Next frame for `worker`: sequential on a single context, otherwise taken
+// from the shared work-stealing queue.
+static int nextFrame(RenderWorker *worker, uint64_t *frame) {
+  RenderJob *job = worker->job;
+  if (job->queue != NULL) {
+    return workQueueNext(job->queue, worker->index, frame);
+  }
+  if (job->maxFrames != (uint64_t)-1 && *frame >= job->maxFrames) {
+    return 0;
+  }
+  (*frame)++;
+  return 1;
+}
+
+// Vertex array of the triangle covering the viewport, left bound.
+static void createFullscreenTriangle(GLuint *vao, GLuint *vbo) {
+  static int vertAttrPosition = 0;
+  static const GLfloat vertices[] = {
+      -1.0f, -1.0f, 1.0f, 3.0f, -1.0f, 1.0f, -1.0f, 3.0f, 1.0f,
+  };
+  glGenVertexArrays(1, vao);
+  glBindVertexArray(*vao);
+  glGenBuffers(1, vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, *vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glVertexAttribPointer(vertAttrPosition, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+  glEnableVertexAttribArray(vertAttrPosition);
+}
+
+/**
+ * Render loop of one context: build the render graph, then render frames
+ * until the job runs out of them. Runs on its own thread when rendering in
+ * parallel, or directly on the main thread.
+ */
+static void *renderWorker(void *arg) {
+  RenderWorker *worker = arg;
+  RenderJob *job = worker->job;
+  RenderingContext *ctx = NULL;
+  GLuint vao = 0, vbo = 0;
+  worker->result = -1;
+  char threadName[TRACE_THREAD_NAME_SIZE];
+  snprintf(threadName, sizeof(threadName), "render %d", worker->index);
+  traceThreadName(threadName);
+  if (!eglMakeCurrent(job->eglDpy, worker->surface, worker->surface,
+                      worker->ctx)) {
+    checkEglError("eglMakeCurrent");
+    goto done;
+  }
+  // Startup phases are those of the first context
+  BenchReport *phases = worker->index == 0 ? job->report : NULL;
+  double phaseStart = monotonic_now();
+  uint64_t span = traceBegin();
+  // prepare Rendering Context
+  if (prepareRenderingContext(&ctx, job->eglDpy, worker->ctx,
+                              worker->surface, worker->tile[2],
+                              worker->tile[3], job->format) != 0) {
+    printf("Failed to prepare rendering context\n");
+    goto done;
+  }
+  ctx->report = job->report;
+  traceEnd("prepare_context", NULL, -1, span);
+  ctx->frameSize[0] = job->width;
+  ctx->frameSize[1] = job->height;
+  ctx->tileOrigin[0] = worker->tile[0];
+  ctx->tileOrigin[1] = worker->tile[1];
+  ctx->output = job->output;
+  if (job->yuvLayout != YUV_NONE) {
+    ctx->yuv.layout = job->yuvLayout;
+    yuvCoefficients(job->yuvMatrix, job->yuvFullRange, &ctx->yuv.coeffs);
+    if (prepareYuvPass(ctx, &ctx->yuv, &ctx->renderTarget) != 0) {
+      printf("Failed to prepare YUV conversion pass\n");
+      goto done;
+    }
+  }
+  // Declare the render graph: Buffer A-D + Image
+  RenderGraph *graph = &ctx->graph;
+  graph->bufferFormat = job->bufferFormat;
+  memcpy(graph->localSize, job->localSize, sizeof(job->localSize));
+  graph->specialize = job->specialize;
+  graph->defines = job->defines;
+  for (int p = 0; p < MAX_PASSES; p++) {
+    memcpy(graph->passes[p].channels, job->channels[p],
+           sizeof(job->channels[p]));
+    if (job->sources[p] != NULL) {
+      graph->passes[p].source = strdup(job->sources[p]);
+    }
+  }
+  if (phases != NULL) {
+    benchPhase(phases, "prepare_context", monotonic_now() - phaseStart);
+    phaseStart = monotonic_now();
+  }
+  if (buildRenderGraph(ctx, &ctx->renderTarget) != 0) {
+    printf("Failed to compile and link OpenGL program\n");
+    goto done;
+  }
+  if (phases != NULL) {
+    benchPhase(phases, "build_programs", monotonic_now() - phaseStart);
+  }
+  if (job->passQueries &&
+      passQueriesInit(&ctx->queries, MAX_PASSES,
+                      hasGlExtension("GL_ARB_pipeline_statistics_query")) !=
+          0) {
+    goto done;
+  }
+  if (job->heatmapFrame > 0 && prepareHeatmap(ctx, job->heatmapFrame) != 0) {
+    goto done;
+  }
+  for (int p = 0; job->queue != NULL && p < MAX_PASSES; p++) {
+    if (graph->passes[p].feedback) {
+      printf("Buffer %s is read back as feedback, its frames must render in "
+             "order: use --threads=1\n",
+             passNames[p]);
+      goto done;
+    }
+  }
+  createFullscreenTriangle(&vao, &vbo);
+
+  log("Render graph created with %d passes\n", graph->count);
+  log("rt.fbo = %u, rt.width = %u, rt.height = %u\n", ctx->renderTarget.fbo,
+      ctx->renderTarget.width, ctx->renderTarget.height);
+  // render loop here
+  glBindVertexArray(vao);
+
+  worker->result = 0;
+  if (job->tiles != NULL) {
+    renderTileLoop(worker, ctx);
+    goto done;
+  }
+  dynresInit(&ctx->dynres, job->targetMs);
+  double loopStart = monotonic_now();
+  double T0 = loopStart;
+  double lastStart = 0.0;
+  double pacedMs = 0.0; // Pacing waits since lastStart
+  uint64_t lastRendered = 0;
+  uint64_t frame = 0;
+  while (!exit_condition && nextFrame(worker, &frame)) {
+    double wake;
+    double now = monotonic_now();
+    PaceAction action = pacerFrame(&job->pacer, frame, now, &wake);
+    if (wake > 0.0) {
+      span = traceBegin();
+      sleepUntil(wake); // Early: wait for the frame's deadline
+      traceEnd("pacing_wait", NULL, (int)frame, span);
+      pacedMs += monotonic_now() - now;
+    }
+    if (action != PACE_RENDER) {
+      // Late in live mode: skip the frame, or read the previous output
+      // back again under this frame's number
+      log("Frame %d is late: %s\n", (int)frame,
+          action == PACE_DROP ? "dropped" : "duplicated");
+      ctx->time.frame = frame;
+      if (action == PACE_DUPLICATE && ctx->output != NULL) {
+        readbackColorBuffer(ctx, &ctx->renderTarget);
+      }
+      continue;
+    }
+    // 6. Render with OpenGL context to the FBO + Texture
+    double start = monotonic_now(), flushStart = 0.0;
+    uint64_t frameSpan = traceBegin();
+    if (frame == 1) {
+      ctx->firstFrameTime = T0 = start;
+    }
+    // The controller sees the render time, not the frame period of
+    // --fps-cap or --live
+    double frameMs = start - lastStart - pacedMs;
+    if (frame > 1 && dynresUpdate(&ctx->dynres, frameMs)) {
+      if (applyRenderScale(ctx) != 0 ||
+          (ctx->graph.specialize && specializeRenderGraph(ctx) != 0)) {
+        worker->result = -1;
+        break;
+      }
+      printf("Frame %d: render scale %.3f (%ux%u), %.3f ms/frame, target "
+             "%.3f ms\n",
+             (int)frame, ctx->dynres.scale, ctx->frameSize[0],
+             ctx->frameSize[1], frameMs, ctx->dynres.targetMs);
+    }
+    lastStart = start;
+    pacedMs = 0.0;
+    timelineFrame(&job->timeline, frame,
+                  (start - ctx->firstFrameTime) / 1000.0, &ctx->time,
+                  &ctx->time);
+    if (job->reload != NULL) {
+      applyHotReload(ctx, job->reload);
+    }
+    passQueriesFrame(&ctx->queries, (int)frame);
+    if (ctx->scaledTarget.fbo != 0) {
+      renderGraphFrame(ctx, &ctx->scaledTarget);
+      span = traceBegin();
+      upscaleToOutput(ctx, &ctx->scaledTarget);
+      traceEnd("upscale", NULL, (int)frame, span);
+    } else {
+      renderGraphFrame(ctx, &ctx->renderTarget);
+    }
+    passQueriesSubmit(&ctx->queries);
+    log("Frame %d: render scale %.3f\n", (int)frame, ctx->dynres.scale);
+    flushStart = monotonic_now();
+    span = traceBegin();
+    if (ctx->output == NULL && ctx->dynres.targetMs <= 0.0) {
+      // Readback and pacing fences submit the frame, without them llvmpipe
+      // would keep deferring it
+      glFlush();
+    }
+    if (ctx->dynres.targetMs > 0.0) {
+      // Keep at most one frame in flight, so the measured frame time
+      // includes the rendering and not just the command submission
+      if (ctx->frameFence != NULL) {
+        glClientWaitSync(ctx->frameFence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         NANOSECONDS_PER_SECOND);
+        glDeleteSync(ctx->frameFence);
+      }
+      ctx->frameFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    traceEnd("flush", NULL, (int)frame, span);
+    if (ctx->report != NULL) {
+      benchRecord(ctx->report, STAGE_FLUSH, monotonic_now() - flushStart);
+    }
+    double gpuMs;
+    while (passQueriesCollect(&ctx->queries, 0, &gpuMs)) {
+      if (ctx->report != NULL) {
+        benchRecord(ctx->report, STAGE_GPU, gpuMs);
+      }
+    }
+    uint64_t rendered = atomic_fetch_add(&job->rendered, 1) + 1;
+    double end = monotonic_now();
+    if (worker->index == 0 && end - T0 >= 5000.0) { // 5 seconds
+      float seconds = (float)(end - T0) / 1000.0f;
+      float fps = (float)(rendered - lastRendered) / seconds;
+      if (ctx->dynres.targetMs > 0.0) {
+        printf("%d frames in %6.3f seconds : %6.3f FPS, render scale %.3f\n",
+               (int)(rendered - lastRendered), seconds, fps,
+               ctx->dynres.scale);
+      } else {
+        printf("%d frames in %6.3f seconds : %6.3f FPS\n",
+               (int)(rendered - lastRendered), seconds, fps);
+      }
+      fflush(stdout);
+      T0 = end;
+      lastRendered = rendered; // Reset
+    }
+    if (ctx->output != NULL) {
+      span = traceBegin();
+      readbackColorBuffer(ctx, &ctx->renderTarget);
+      traceEnd("readback", NULL, (int)frame, span);
+      if (ctx->output->stream != NULL && ctx->output->stream->failed) {
+        exit_condition = 1; // Reader went away
+      }
+    }
+    traceEnd("frame", NULL, (int)frame, frameSpan);
+    if (ctx->report != NULL) {
+      double ms = monotonic_now() - start;
+      benchRecord(ctx->report, STAGE_FRAME, ms);
+      if (phases != NULL && frame == 1) {
+        benchPhase(phases, "first_frame", ms);
+      }
+    }
+  }
+  if (job->pacer.periodMs > 0.0) {
+    printf("Pacing: %.3f ms/frame, %llu deadline misses, %llu dropped, %llu "
+           "duplicated\n",
+           job->pacer.periodMs, (unsigned long long)job->pacer.misses,
+           (unsigned long long)job->pacer.drops,
+           (unsigned long long)job->pacer.duplicates);
+  }
+  if (ctx->dynres.changes > 0) {
+    printf("Dynamic resolution: %d scale changes, final scale %.3f\n",
+           ctx->dynres.changes, ctx->dynres.scale);
+  }
+
+  // Flush in-flight readbacks
+  finishReadback(ctx);
+  glFinish();
+  worker->renderMs = monotonic_now() - loopStart;
+  if (ctx->queries.passes > 0) {
+    double gpuMs;
+    while (passQueriesCollect(&ctx->queries, 1, &gpuMs)) {
+      if (ctx->report != NULL) {
+        benchRecord(ctx->report, STAGE_GPU, gpuMs);
+      }
+    }
+    printPassQueries(&ctx->queries, worker->index);
+  }
+done:
+  if (job->tiles != NULL && worker->result != 0) {
+    renderTileLoop(worker, NULL); // Keep the barriers in step until stopped
+  }
+  if (worker->result != 0) {
+    exit_condition = 1;
+    if (job->output != NULL) {
+      encoderPoolCancel(job->output->encoder); // Don't wait for our frames
+    }
+  }
+  if (ctx != NULL) {
+    // Cleanup OpenGL resources
+    log("Cleaning up OpenGL resources...\n");
+    bindFramebuffer(ctx, 0);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    if (ctx->frameFence != NULL) {
+      glDeleteSync(ctx->frameFence);
+    }
+    releaseRenderTarget(ctx, &ctx->renderTarget);
+    releaseRenderTarget(ctx, &ctx->scaledTarget);
+    if (ctx->yuv.prog > 0) {
+      releaseRenderTarget(ctx, &ctx->yuv.target);
+      glDeleteProgram(ctx->yuv.prog);
+    }
+    if (ctx->heatmap.prog > 0) {
+      glDeleteProgram(ctx->heatmap.prog);
+    }
+    passQueriesDestroy(&ctx->queries);
+    readbackRingDestroy(&ctx->readback);
+    destroyRenderGraph(ctx);
+    drainRenderTargetPool(ctx);
+    glFinish();
+    free(ctx);
+  }
+  eglMakeCurrent(job->eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  return NULL;
+}
+
+/**
+ * Tile loop of one context: render its tile of every frame published by
+ * renderTiledFrames and read it back straight into its place in the frame.
+ * `ctx` is NULL if the context failed to set up, it then only keeps the
+ * barriers in step until the frames stop.
+ */
+static void renderTileLoop(RenderWorker *worker, RenderingContext *ctx) {
+  RenderJob *job = worker->job;
+  TileFrame *tiles = job->tiles;
+  const GLint *tile = worker->tile;
+  pthread_barrier_wait(&tiles->ready);
+  for (;;) {
+    pthread_barrier_wait(&tiles->start);
+    if (tiles->stop) {
+      break;
+    }
+    if (ctx != NULL) {
+      ctx->time = tiles->time;
+      renderGraphFrame(ctx, &ctx->renderTarget);
+      bindFramebuffer(ctx, ctx->renderTarget.fbo);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glPixelStorei(GL_PACK_ROW_LENGTH, job->width);
+      glReadPixels(0, 0, tile[2], tile[3], ctx->format->readFormat,
+                   ctx->format->readType,
+                   tiles->pixels + ((size_t)tile[1] * job->width + tile[0]) *
+                                       ctx->format->bytesPerPixel);
+      glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    }
+    pthread_barrier_wait(&tiles->finished);
+  }
+}
+
+/**
+ * Drive tiled rendering from the main thread: publish each frame to the tile
+ * contexts, wait for all tiles, then hand the assembled frame to the output.
+ * Tiles are read into an encoder buffer, so frames are not copied again.
+ */
+static int renderTiledFrames(RenderJob *job, RenderWorker *workers) {
+  TileFrame *tiles = job->tiles;
+  FrameOutput *out = job->output;
+  const size_t size =
+      (size_t)job->width * job->height * job->format->bytesPerPixel;
+  unsigned char *scratch = NULL; // Frame when nothing is written out
+  int result = 0;
+  pthread_barrier_wait(&tiles->ready);
+  for (int w = 0; w < tiles->cols * tiles->rows; w++) {
+    result = workers[w].result != 0 ? -1 : result;
+  }
+  double T0 = monotonic_now(), firstFrameTime = T0, latency = 0.0;
+  uint64_t lastRendered = 0;
+  for (uint64_t frame = 1; result == 0 && !exit_condition &&
+                           (job->maxFrames == (uint64_t)-1 ||
+                            frame <= job->maxFrames);
+       frame++) {
+    double start = monotonic_now();
+    if (frame == 1) {
+      firstFrameTime = T0 = start;
+    }
+    timelineFrame(&job->timeline, frame, (start - firstFrameTime) / 1000.0,
+                  &tiles->time, &tiles->time);
+    EncodeBuffer *buf = NULL;
+    if (out != NULL) {
+      buf = encoderAcquireBuffer(out->encoder, size);
+      tiles->pixels = buf != NULL ? buf->data : NULL;
+    } else {
+      scratch = scratch != NULL ? scratch : malloc(size);
+      tiles->pixels = scratch;
+    }
+    if (tiles->pixels == NULL) {
+      printf("Failed to allocate tiled frame %d\n", (int)frame);
+      result = -1;
+      break;
+    }
+    pthread_barrier_wait(&tiles->start);
+    pthread_barrier_wait(&tiles->finished);
+    uint64_t rendered = atomic_fetch_add(&job->rendered, 1) + 1;
+    double end = monotonic_now();
+    latency += end - start;
+    if (buf != NULL) {
+      submitFrameBuffer(out, frame, buf, job->width, job->height);
+      if (out->stream != NULL && out->stream->failed) {
+        exit_condition = 1; // Reader went away
+      }
+    }
+    if (end - T0 >= 5000.0) { // 5 seconds
+      float seconds = (float)(end - T0) / 1000.0f;
+      printf("%d frames in %6.3f seconds : %6.3f FPS\n",
+             (int)(rendered - lastRendered), seconds,
+             (float)(rendered - lastRendered) / seconds);
+      fflush(stdout);
+      T0 = end;
+      lastRendered = rendered; // Reset
+    }
+  }
+  tiles->stop = 1;
+  pthread_barrier_wait(&tiles->start);
+  uint64_t rendered = atomic_load(&job->rendered);
+  printf("Tiles: %dx%d, %llu frames, %.3f ms/frame latency\n", tiles->cols,
+         tiles->rows, (unsigned long long)rendered,
+         rendered > 0 ? latency / rendered : 0.0);
+  free(scratch);
+  return result;
+}
+
+/**
+ * Render the frames of `job` twice on the calling thread, whose context is
+ * current, with the two variants compared by `mode`: the raster and compute
+ * backends, or uniform and specialized iResolution. Which one wins depends on
+ * the shader, notably on CPU rasterizers.
+ */
+static int benchVariants(RenderJob *job, RenderWorker *worker, BenchMode mode,
+                         const GLuint localSize[2]) {
+  static const char *names[][2] = {
+      [BENCH_BACKENDS] = {"raster", "compute"},
+      [BENCH_SPECIALIZE] = {"uniform", "specialized"},
+  };
+  double msPerFrame[2];
+  for (int v = 0; v < 2; v++) {
+    if (mode == BENCH_BACKENDS) {
+      job->localSize[0] = v ? localSize[0] : 0;
+      job->localSize[1] = v ? localSize[1] : 0;
+    } else {
+      job->specialize = v;
+    }
+    atomic_store(&job->rendered, 0);
+    worker->job = job;
+    renderWorker(worker);
+    if (worker->result != 0) {
+      printf("Variant %s failed\n", names[mode][v]);
+      return -1;
+    }
+    uint64_t rendered = atomic_load(&job->rendered);
+    msPerFrame[v] = rendered > 0 ? worker->renderMs / rendered : 0.0;
+    printf("Variant %s: %llu frames in %.3f ms, %.3f ms/frame\n",
+           names[mode][v], (unsigned long long)rendered, worker->renderMs,
+           msPerFrame[v]);
+  }
+  int faster = msPerFrame[1] < msPerFrame[0];
+  printf("Faster: %s (%.2fx)\n", names[mode][faster],
+         msPerFrame[!faster] / msPerFrame[faster]);
+  return 0;
+}
+
+/**
+ * Read a --batch list: one shader file per line, optionally followed by the
+ * iTime to render it at. Blank lines and lines starting with '#' are skipped.
+ */
+static int loadBatch(const char *list, double startTime, Batch *batch) {
+  FILE *f = fopen(list, "r");
+  if (f == NULL) {
+    printf("Failed to open batch list %s: %s\n", list, strerror(errno));
+    return -1;
+  }
+  char line[1024], file[1024];
+  int capacity = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    double time = startTime;
+    if (sscanf(line, "%1023s %lf", file, &time) < 1 || file[0] == '#') {
+      continue;
+    }
+    if (batch->count == capacity) {
+      capacity = capacity > 0 ? capacity * 2 : 64;
+      BatchItem *items = realloc(batch->items, capacity * sizeof(BatchItem));
+      if (items == NULL) {
+        printf("Failed to allocate batch jobs\n");
+        fclose(f);
+        return -1;
+      }
+      batch->items = items;
+    }
+    BatchItem item = {
+        .file = strdup(file), .name = shaderName(file), .time = time};
+    batch->items[batch->count++] = item;
+  }
+  fclose(f);
+  if (batch->count == 0) {
+    printf("Batch list %s has no jobs\n", list);
+    return -1;
+  }
+  return 0;
+}
+
+// Slice an atlas page that was read back into one output frame per job.
+static void writeAtlas(void *user, int page, const void *pixels, size_t size,
+                       unsigned int width, unsigned int height) {
+  Batch *batch = user;
+  const size_t bpp = size / ((size_t)width * height);
+  const size_t row = batch->tileWidth * bpp;
+  const int perPage = batch->cols * batch->rows;
+  for (int t = 0; t < perPage && page * perPage + t < batch->count; t++) {
+    int index = page * perPage + t;
+    EncodeBuffer *buf =
+        encoderAcquireBuffer(batch->output->encoder, row * batch->tileHeight);
+    if (buf == NULL) {
+      printf("Failed to allocate encode buffer for job %d\n", index + 1);
+      continue;
+    }
+    size_t x = (t % batch->cols) * batch->tileWidth;
+    size_t y = (t / batch->cols) * batch->tileHeight;
+    for (GLuint r = 0; r < batch->tileHeight; r++) {
+      memcpy((unsigned char *)buf->data + r * row,
+             (const unsigned char *)pixels + ((y + r) * width + x) * bpp, row);
+    }
+    // <name>_<line>.png, so one shader may be listed at several times
+    FrameOutput out = *batch->output;
+    out.name = batch->items[index].name;
+    submitFrameBuffer(&out, index + 1, buf, batch->tileWidth,
+                      batch->tileHeight);
+  }
+}
+
+/**
+ * Render the jobs of a --batch list as tiles of atlas pages on the calling
+ * thread, whose context is current. Every tile of a page is drawn with its own
+ * viewport, scissor and range of one uniform buffer, then the whole page is
+ * read back at once and sliced into per-job frames.
+ */
+static int renderBatch(RenderJob *job, RenderWorker *worker,
+                       const char *list) {
+  Batch batch = {
+      .tileWidth = job->width,
+      .tileHeight = job->height,
+      .output = job->output,
+  };
+  RenderingContext *ctx = NULL;
+  GLuint vao = 0, vbo = 0, ubo = 0;
+  unsigned char *uniforms = NULL;
+  ProgramRequest *requests = NULL; // One per distinct file
+  int *owner = NULL;               // Item whose program each item uses
+  int sources = 0;
+  int result = -1;
+  double start = monotonic_now();
+  if (loadBatch(list, job->timeline.startTime, &batch) != 0) {
+    goto done;
+  }
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  maxSize = maxSize < BATCH_ATLAS_MAX_SIZE ? maxSize : BATCH_ATLAS_MAX_SIZE;
+  if (batch.tileWidth > (GLuint)maxSize || batch.tileHeight > (GLuint)maxSize) {
+    printf("Batch jobs of %ux%u do not fit in a %dx%d atlas\n",
+           batch.tileWidth, batch.tileHeight, maxSize, maxSize);
+    goto done;
+  }
+  batch.cols = maxSize / batch.tileWidth;
+  batch.cols = batch.cols < batch.count ? batch.cols : batch.count;
+  batch.rows = maxSize / batch.tileHeight;
+  int neededRows = (batch.count + batch.cols - 1) / batch.cols;
+  batch.rows = batch.rows < neededRows ? batch.rows : neededRows;
+  const int perPage = batch.cols * batch.rows;
+  const int pages = (batch.count + perPage - 1) / perPage;
+  if (prepareRenderingContext(&ctx, job->eglDpy, worker->ctx, worker->surface,
+                              batch.cols * batch.tileWidth,
+                              batch.rows * batch.tileHeight,
+                              job->format) != 0) {
+    printf("Failed to prepare rendering context\n");
+    goto done;
+  }
+  ctx->graph.specialize = job->specialize;
+  ctx->graph.defines = job->defines;
+  // Load each file once and build them all at once, the program cache also
+  // merges identical sources
+  requests = calloc(batch.count, sizeof(ProgramRequest));
+  owner = calloc(batch.count, sizeof(int));
+  if (requests == NULL || owner == NULL) {
+    printf("Failed to allocate program requests\n");
+    goto done;
+  }
+  for (int i = 0; i < batch.count; i++) {
+    BatchItem *item = &batch.items[i];
+    owner[i] = i;
+    for (int j = 0; j < i && owner[i] == i; j++) {
+      if (strcmp(batch.items[j].file, item->file) == 0) {
+        owner[i] = owner[j];
+      }
+    }
+    if (owner[i] != i) {
+      continue;
+    }
+    char *source = NULL;
+    if (loadShaderSource(item->file, &source) != 0) {
+      goto done;
+    }
+    ProgramRequest request = {
+        .source = source,
+        .format = ctx->format->internalFormat,
+        .width = batch.tileWidth,
+        .height = batch.tileHeight,
+    };
+    requests[sources++] = request;
+  }
+  cachedPrograms(ctx, requests, sources);
+  for (int i = 0, k = 0; i < batch.count; i++) {
+    BatchItem *item = &batch.items[i];
+    if (owner[i] != i) {
+      item->prog = batch.items[owner[i]].prog;
+      continue;
+    }
+    item->prog = requests[k++].prog;
+    if (item->prog < 0) {
+      printf("Failed to build %s\n", item->file);
+      goto done;
+    }
+  }
+  GLint align = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+  const GLsizeiptr stride =
+      (sizeof(ShadertoyUniforms) + align - 1) / align * align;
+  uniforms = calloc(perPage, stride);
+  if (uniforms == NULL) {
+    printf("Failed to allocate uniform data\n");
+    goto done;
+  }
+  glCreateBuffers(1, &ubo);
+  glNamedBufferStorage(ubo, perPage * stride, NULL, GL_DYNAMIC_STORAGE_BIT);
+  createFullscreenTriangle(&vao, &vbo);
+  const PixelFormat *format = ctx->format;
+  RenderTarget *atlas = &ctx->renderTarget;
+  if (batch.output != NULL &&
+      readbackRingInit(&ctx->readback, atlas->width, atlas->height,
+                       atlas->width, atlas->height, format->readFormat,
+                       format->readType, format->bytesPerPixel) != 0) {
+    goto done;
+  }
+  bindFramebuffer(ctx, atlas->fbo);
+  glEnable(GL_SCISSOR_TEST);
+  for (int page = 0; page < pages && !exit_condition; page++) {
+    int tiles = batch.count - page * perPage;
+    tiles = tiles < perPage ? tiles : perPage;
+    // Inputs of every tile of the page in one upload
+    for (int t = 0; t < tiles; t++) {
+      const BatchItem *item = &batch.items[page * perPage + t];
+      FrameTime time;
+      timelineFrame(&job->timeline, 1, 0.0, &time, &time);
+      time.date += item->time - time.time;
+      time.time = item->time;
+      ShadertoyUniforms *u = (ShadertoyUniforms *)(uniforms + t * stride);
+      shadertoyFrameUniforms(&time, u);
+      u->iResolution[0] = batch.tileWidth;
+      u->iResolution[1] = batch.tileHeight;
+      u->iResolution[2] = 1.0f;
+      // fragCoord is relative to the tile
+      u->iTileOffset[0] = -(GLfloat)((t % batch.cols) * batch.tileWidth);
+      u->iTileOffset[1] = -(GLfloat)((t / batch.cols) * batch.tileHeight);
+    }
+    glNamedBufferSubData(ubo, 0, tiles * stride, uniforms);
+    for (int t = 0; t < tiles; t++) {
+      GLint x = (t % batch.cols) * batch.tileWidth;
+      GLint y = (t / batch.cols) * batch.tileHeight;
+      useProgram(ctx, batch.items[page * perPage + t].prog);
+      setViewportRect(ctx, x, y, batch.tileWidth, batch.tileHeight);
+      glScissor(x, y, batch.tileWidth, batch.tileHeight);
+      bindUniforms(ctx, ubo, t * stride);
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    checkGLError("After drawing atlas page");
+    if (batch.output != NULL) {
+      readbackRingPush(&ctx->readback, page, writeAtlas, &batch);
+    }
+  }
+  glDisable(GL_SCISSOR_TEST);
+  if (batch.output != NULL) {
+    readbackRingDrain(&ctx->readback, writeAtlas, &batch);
+  }
+  glFinish();
+  double ms = monotonic_now() - start;
+  printf("Batch: %d jobs, %d shaders, %d atlas pages of %ux%u (%dx%d tiles) "
+         "in %.3f ms, %.3f ms/job\n",
+         batch.count, ctx->programs.count, pages, atlas->width, atlas->height, batch.cols,
+         batch.rows, ms, ms / batch.count);
+  result = 0;
+done:
+  if (ctx != NULL) {
+    useProgram(ctx, 0);
+    bindUniforms(ctx, 0, 0);
+    bindFramebuffer(ctx, 0);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ubo);
+    readbackRingDestroy(&ctx->readback);
+    programCacheDestroy(&ctx->programs);
+    releaseRenderTarget(ctx, &ctx->renderTarget);
+    drainRenderTargetPool(ctx);
+    free(ctx);
+  }
+  for (int i = 0; i < batch.count; i++) {
+    BatchItem *item = &batch.items[i];
+    free(item->file);
+    free(item->name);
+  }
+  free(batch.items);
+  for (int i = 0; i < sources; i++) {
+    free((char *)requests[i].source);
+  }
+  free(requests);
+  free(owner);
+  free(uniforms);
+  return result;
+}
+
+static void bindFramebuffer(RenderingContext *ctx, GLuint fbo) {
+  if (ctx->state.fbo != fbo) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    ctx->state.fbo = fbo;
+    checkFrameBufferStatus("After binding framebuffer");
+  }
+}
+
+static void setViewportRect(RenderingContext *ctx, GLint x, GLint y,
+                            GLuint width, GLuint height) {
+  GLint *v = ctx->state.viewport;
+  if (v[0] != x || v[1] != y || v[2] != (GLint)width ||
+      v[3] != (GLint)height) {
+    glViewport(x, y, width, height);
+    v[0] = x;
+    v[1] = y;
+    v[2] = width;
+    v[3] = height;
+  }
+}
+
+static void setViewport(RenderingContext *ctx, GLuint width, GLuint height) {
+  setViewportRect(ctx, 0, 0, width, height);
+}
+
+static void useProgram(RenderingContext *ctx, GLuint program) {
+  if (ctx->state.program != program) {
+    glUseProgram(program);
+    ctx->state.program = program;
+  }
+}
+
+static void bindUniforms(RenderingContext *ctx, GLuint buffer,
+                         GLintptr offset) {
+  if (ctx->state.uniformBuffer != buffer ||
+      ctx->state.uniformOffset != offset) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, SHADERTOY_UNIFORM_BINDING, buffer,
+                      offset, sizeof(ShadertoyUniforms));
+    ctx->state.uniformBuffer = buffer;
+    ctx->state.uniformOffset = offset;
+  }
+}
+
+static void bindTexture(RenderingContext *ctx, int unit, GLuint texture) {
+  if (ctx->state.textures[unit] != texture) {
+    glBindTextureUnit(unit, texture);
+    ctx->state.textures[unit] = texture;
+  }
+}
+
+void clearColorBuffer(GLint buffer) {
+  static const GLfloat learColor[] = {0.f, 0.f, 0.f, 1.0f};
+  glClearBufferfv(GL_COLOR, buffer, learColor);
+  // old way to clear color
+  // glClearColor(learColor[0], learColor[1], learColor[2], learColor[3]);
+  // glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void draw(RenderingContext *ctx, RenderPass pass) {
+  assert(ctx != NULL);
+  // begin renderpass
+  log("Draw iTime = %.3f, iFrame=%d\n", ctx->time.time, ctx->time.frame);
+  useProgram(ctx, pass.prog->id);
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    bindTexture(ctx, i, pass.channels[i]);
+  }
+  // Inputs were uploaded for every pass at the start of the frame
+  bindUniforms(ctx, ctx->graph.uniformBuffer, pass.uniforms);
+  checkGLError("Before drawing");
+  const GLuint *local = pass.prog->localSize;
+  if (local[0] > 0) {
+    // One invocation per pixel, written with imageStore
+    glBindImageTexture(0, pass.rt->color0, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                       pass.rt->format);
+    glDispatchCompute((pass.rt->width + local[0] - 1) / local[0],
+                      (pass.rt->height + local[1] - 1) / local[1], 1);
+    // Make the writes visible to the next passes, blits and readback
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                    GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                    GL_FRAMEBUFFER_BARRIER_BIT);
+  } else {
+    // No clear: the fullscreen triangle covers every pixel without blending,
+    // and targets are cleared once when they are created.
+    bindFramebuffer(ctx, pass.rt->fbo);
+    setViewport(ctx, pass.rt->width, pass.rt->height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  }
+  checkGLError("After drawing");
+}
+
+// Hand `buf`, from encoderAcquireBuffer, to the stream or the PNG encoders.
+static void submitFrameBuffer(FrameOutput *out, int frame, EncodeBuffer *buf,
+                              unsigned int width, unsigned int height) {
+  if (out->stream != NULL) {
+    encoderSubmitBuffer(out->encoder, NULL, frame, buf, width, height);
+    return;
+  }
+  const size_t filename_len = 20 + strlen(out->dir) + strlen(out->name);
+  char *output_file = calloc(filename_len, sizeof(char));
+  snprintf(output_file, filename_len - 1, "%s/%s_%04d.png", out->dir,
+           out->name, frame);
+  encoderSubmitBuffer(out->encoder, output_file, frame, buf, width, height);
+  free(output_file);
+}
+
+// EncodeObserver of --bench.
+static void recordEncode(void *user, int frame, double ms) {
+  (void)frame;
+  benchRecord(user, STAGE_ENCODE, ms);
+}
+
+// ReadbackConsumer: queue a finished frame for PNG encoding or streaming.
+static void writeFrame(void *user, int frame, const void *pixels, size_t size,
+                       unsigned int width, unsigned int height) {
+  RenderingContext *ctx = user;
+  FrameOutput *out = ctx->output;
+  // Hand a copy of the pixels to the encoder threads
+  EncodeBuffer *buf = encoderAcquireBuffer(out->encoder, size);
+  if (buf == NULL) {
+    printf("Failed to allocate encode buffer for frame %d\n", frame);
+    return;
+  }
+  double start = monotonic_now();
+  uint64_t span = traceBegin();
+  memcpy(buf->data, pixels, size);
+  traceEnd("map_copy", NULL, frame, span);
+  if (ctx->report != NULL) {
+    benchRecord(ctx->report, STAGE_MAP,
+                ctx->readback.waitMs + monotonic_now() - start);
+  }
+  submitFrameBuffer(out, frame, buf, width, height);
+}
+
+// Render `src` into the 4:2:0 planes of pass->target.
+static void convertToYuv(RenderingContext *ctx, YuvPass *pass,
+                         RenderTarget *src) {
+  if (pass->target.width != src->width ||
+      pass->target.height != src->height * 3 / 2) {
+    if (prepareYuvPass(ctx, pass, src) != 0) {
+      exit_condition = 1;
+      return;
+    }
+  }
+  bindFramebuffer(ctx, pass->target.fbo);
+  setViewport(ctx, pass->target.width, pass->target.height);
+  useProgram(ctx, pass->prog);
+  bindTexture(ctx, 0, src->color0);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  checkGLError("After YUV conversion");
+}
+
+void readbackColorBuffer(RenderingContext *ctx, RenderTarget *rt) {
+#ifndef NDEBUG
+  printf("Read back color buffer from RT %u using PBO...\n", rt->fbo);
+#endif
+  RenderTarget *src = rt;
+  GLenum format = ctx->format->readFormat;
+  GLenum type = ctx->format->readType;
+  size_t bytesPerPixel = ctx->format->bytesPerPixel;
+  if (ctx->yuv.layout != YUV_NONE) {
+    // Read back 1.5 bytes per pixel instead of 4
+    convertToYuv(ctx, &ctx->yuv, rt);
+    src = &ctx->yuv.target;
+    format = GL_RED;
+    type = GL_UNSIGNED_BYTE;
+    bytesPerPixel = 1;
+  }
+  ReadbackRing *ring = &ctx->readback;
+  if (ring->readWidth != src->width || ring->readHeight != src->height ||
+      ring->format != format || ring->type != type) {
+    finishReadback(ctx);
+    readbackRingDestroy(ring);
+    if (readbackRingInit(ring, rt->width, rt->height, src->width,
+                         src->height, format, type, bytesPerPixel) != 0) {
+      exit_condition = 1;
+      return;
+    }
+    checkGLError("After creating readback ring");
+  }
+  bindFramebuffer(ctx, src->fbo);
+  // Read pixels into the next free PBO, consuming finished ones first
+  readbackRingPush(ring, ctx->time.frame, writeFrame, ctx);
+  checkGLError("After glReadPixels with PBO");
+  log("glReadPixels in %.3f ms\n", ring->readMs);
+  if (ctx->report != NULL) {
+    benchRecord(ctx->report, STAGE_READ_PIXELS, ring->readMs);
+  }
+}
+
+// Wait for every in-flight readback and hand it to the output.
+void finishReadback(RenderingContext *ctx) {
+  if (ctx->readback.count > 0)
+    readbackRingDrain(&ctx->readback, writeFrame, ctx);
+}
+
+/**
+ * Compile `shader`. Debug builds, and release builds given `check`, wait for
+ * the compiler and print its log on failure, leaving `*shader` 0. Otherwise
+ * errors only show when the program is linked.
+ */
+static void compileShader(GLuint *shader, GLenum type, const char **source,
+                          GLsizei shader_count, GLint *shader_lengths,
+                          int check) {
+  *shader = glCreateShader(type);
+  if (*shader == 0) {
+    printf("Failed to create shader of type %d\n", type);
+    return;
+  }
+  glShaderSource(*shader, shader_count, source, shader_lengths);
+  glCompileShader(*shader);
+#ifdef NDEBUG
+  if (!check) {
+    return;
+  }
+#else
+  (void)check;
+#endif
+  GLint compileStatus;
+  glGetShaderiv(*shader, GL_COMPILE_STATUS, &compileStatus);
+  if (compileStatus == GL_FALSE) {
+    GLint logLength;
     glGetShaderiv(*shader, GL_INFO_LOG_LENGTH, &logLength);
     char *log = calloc(logLength + 1, sizeof(char));
     glGetShaderInfoLog(*shader, logLength, NULL, log);
@@ -426,115 +2267,1139 @@ static void compileShader(GLuint *shader, GLenum type, const char **source,
     glDeleteShader(*shader);
     *shader = 0;
   }
-#endif
 }
 
-GLint compileAndLinkProgram(const char *vertexShaderSource,
-                            const char *fragmentShaderSource) {
-  GLuint prog = glCreateProgram();
-  if (prog == 0) {
-    printf("Failed to create OpenGL program\n");
+/**
+ * Start building a program from `count` shaders of `types`, the first taking
+ * `counts[0]` strings of `sources`, the next the following `counts[1]`, and so
+ * on. A program in the binary cache is loaded instead. Otherwise the link is
+ * only issued, finishProgram waits for it.
+ */
+static int startProgram(PendingProgram *pending, int count,
+                        const GLenum *types, const char **sources,
+                        const int *counts) {
+  int total = 0;
+  for (int i = 0; i < count; i++) {
+    total += counts[i];
+  }
+  pending->binaryKey = binaryCacheKey(&programBinaries, sources, total);
+  pending->prog = binaryCacheLoad(&programBinaries, &pending->binaryKey);
+  pending->loaded = pending->prog != 0;
+  if (pending->loaded) {
+    return 0;
+  }
+  pending->prog = glCreateProgram();
+  if (pending->prog == 0) {
+    printf("Failed to create OpenGL program\n");
+    return -1;
+  }
+  if (programBinaries.dir != NULL) {
+    glProgramParameteri(pending->prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  }
+  int failed = 0;
+  for (int i = 0; i < count; i++) {
+    GLuint shader;
+    compileShader(&shader, types[i], sources, counts[i], NULL,
+                  pending->checkCompile);
+    sources += counts[i];
+    if (shader == 0) {
+      failed = 1;
+      continue;
+    }
+    // Deleted along with the program
+    glAttachShader(pending->prog, shader);
+    glDeleteShader(shader);
+  }
+  if (failed) {
+    log("Failed to compile shaders\n");
+    glDeleteProgram(pending->prog);
+    pending->prog = 0;
+    return -1;
+  }
+  glLinkProgram(pending->prog);
+  return 0;
+}
+
+/**
+ * Wait for the link issued by startProgram and store the program in the
+ * binary cache. Returns the program, or -1 after deleting it.
+ */
+static GLint finishProgram(PendingProgram *pending) {
+  if (pending->loaded) {
+    return pending->prog;
+  }
+  GLint linkStatus;
+  glGetProgramiv(pending->prog, GL_LINK_STATUS, &linkStatus);
+  if (linkStatus == GL_FALSE) {
+    GLint logLength;
+    glGetProgramiv(pending->prog, GL_INFO_LOG_LENGTH, &logLength);
+    char *logstr = calloc(logLength + 1, sizeof(char));
+    glGetProgramInfoLog(pending->prog, logLength, NULL, logstr);
+    log("Failed to link program, log:\n%s\n", logstr);
+    free(logstr);
+    glDeleteProgram(pending->prog);
+    pending->prog = 0;
+    return -1;
+  }
+  binaryCacheStore(&programBinaries, &pending->binaryKey, pending->prog);
+  return pending->prog;
+}
+
+/**
+ * Start building a program from a vertex shader and either a complete
+ * fragment shader or a mainImage source, which gets the Shadertoy header, the
+ * `constants` set (may be NULL) and the main entry around it.
+ */
+static int startRasterProgram(PendingProgram *pending,
+                              const char *vertexShaderSource,
+                              const char *fragmentShaderSource,
+                              const char *constants) {
+  const GLenum types[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+  int counts[] = {1, 1};
+  const char *sources[6] = {vertexShaderSource, fragmentShaderSource};
+  if (strstr(fragmentShaderSource, "#version") == NULL &&
+      strstr(fragmentShaderSource, "void mainImage") != NULL) {
+    // append header to fragment shader source
+    const char *fragment_shaders[] = {
+        FRAGMENT_SHADER_HEADER,
+        SHADERTOY_INPUTS,
+        constants != NULL ? constants : "",
+        fragmentShaderSource,
+        FRAGMENT_SHADER_MAIN_ENTRY,
+    };
+    memcpy(sources + 1, fragment_shaders, sizeof(fragment_shaders));
+    counts[1] = 5;
+  }
+  return startProgram(pending, 2, types, sources, counts);
+}
+
+GLint compileAndLinkProgram(const char *vertexShaderSource,
+                            const char *fragmentShaderSource,
+                            const char *constants) {
+  PendingProgram pending;
+  if (startRasterProgram(&pending, vertexShaderSource, fragmentShaderSource,
+                         constants) != 0) {
+    return -1;
+  }
+  return finishProgram(&pending);
+}
+
+/**
+ * Start building a compute program running a mainImage `source` per pixel of
+ * an image of `internalFormat`, in workgroups of `localSize`, with the
+ * `constants` set (may be NULL).
+ */
+static int startComputeProgram(PendingProgram *pending, const char *source,
+                               const char *constants, GLenum internalFormat,
+                               const GLuint localSize[2]) {
+  const char *format = imageFormatQualifier(internalFormat);
+  if (format == NULL) {
+    printf("Format 0x%x cannot be written by a compute shader\n",
+           internalFormat);
+    return -1;
+  }
+  if (strstr(source, "#version") != NULL ||
+      strstr(source, "void mainImage") == NULL) {
+    printf("The compute backend needs a mainImage shader without #version\n");
+    return -1;
+  }
+  char defines[128];
+  snprintf(defines, sizeof(defines),
+           "#version 450 core\n#define LOCAL_SIZE_X %u\n"
+           "#define LOCAL_SIZE_Y %u\n#define OUTPUT_FORMAT %s\n",
+           localSize[0], localSize[1], format);
+  const GLenum types[] = {GL_COMPUTE_SHADER};
+  const int counts[] = {6};
+  const char *sources[] = {defines,
+                           COMPUTE_SHADER_HEADER,
+                           SHADERTOY_INPUTS,
+                           constants != NULL ? constants : "",
+                           source,
+                           COMPUTE_SHADER_MAIN_ENTRY};
+  return startProgram(pending, 1, types, sources, counts);
+}
+
+GLint compileAndLinkCompute(const char *source, const char *constants,
+                            GLenum internalFormat, const GLuint localSize[2]) {
+  PendingProgram pending;
+  if (startComputeProgram(&pending, source, constants, internalFormat,
+                          localSize) != 0) {
+    return -1;
+  }
+  return finishProgram(&pending);
+}
+
+// Parse "A".."D" or "image" (case-insensitive) at the start of `name`.
+static int parsePassName(const char *name, const char **end) {
+  int pass = -1;
+  size_t len = 0;
+  if (strncasecmp(name, "image", 5) == 0) {
+    pass = IMAGE_PASS;
+    len = 5;
+  } else if ((name[0] >= 'a' && name[0] <= 'd') ||
+             (name[0] >= 'A' && name[0] <= 'D')) {
+    pass = (name[0] | 0x20) - 'a';
+    len = 1;
+  }
+  if (end != NULL) {
+    *end = name + len;
+  }
+  return pass;
+}
+
+// Output file name prefix of a shader: its file name without extension.
+static char *shaderName(const char *file) {
+  const char *name = strrchr(file, '/');
+  if (name == NULL) {
+    name = file; // No directory, use the whole file name
+  } else {
+    name++; // Skip the directory part
+  }
+  const char *ext = strchr(name, '.');
+  return strndup(name, ext != NULL ? (size_t)(ext - name) : strlen(name));
+}
+
+// Read a Shadertoy fragment shader that defines mainImage.
+static int loadShaderSource(const char *file, char **source) {
+  size_t len = 0;
+  if (readFile(file, source, &len) != 0) {
+    log("Failed to read fragment shader file: %s\n", file);
+    return -1;
+  }
+  if (strstr(*source, "void mainImage") == NULL) {
+    printf("Fragment shader file %s does not contain 'void mainImage'\n",
+           file);
+    free(*source);
+    *source = NULL;
     return -1;
   }
+  return 0;
+}
+
+// Order passes so every pass runs after the passes it reads from, keeping the
+// Shadertoy A-D, Image order among independent passes. Self reads and cycles
+// become feedback: the reader gets the previous frame of its source.
+static void sortRenderGraph(RenderGraph *graph) {
+  int placed[MAX_PASSES] = {0};
+  int total = 0;
+  graph->count = 0;
+  for (int p = 0; p < MAX_PASSES; p++) {
+    total += graph->passes[p].prog.id > 0;
+  }
+  while (graph->count < total) {
+    int next = -1;
+    for (int p = 0; p < MAX_PASSES && next < 0; p++) {
+      GraphPass *pass = &graph->passes[p];
+      if (placed[p] || pass->prog.id <= 0) {
+        continue;
+      }
+      int ready = 1;
+      for (int c = 0; c < MAX_CHANNELS; c++) {
+        int src = pass->channels[c];
+        if (src >= 0 && src != p && !placed[src]) {
+          ready = 0;
+        }
+      }
+      next = ready ? p : -1;
+    }
+    if (next < 0) {
+      // Cycle: break it at the first remaining pass in declaration order
+      for (int p = 0; p < MAX_PASSES && next < 0; p++) {
+        if (!placed[p] && graph->passes[p].prog.id > 0) {
+          next = p;
+        }
+      }
+    }
+    placed[next] = 1;
+    graph->order[graph->count++] = next;
+  }
+  // A buffer read at or before its own position needs a second target
+  for (int k = 0; k < graph->count; k++) {
+    GraphPass *pass = &graph->passes[graph->order[k]];
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      int src = pass->channels[c];
+      for (int j = k; src >= 0 && j < graph->count; j++) {
+        if (graph->order[j] == src) {
+          graph->passes[src].feedback = 1;
+        }
+      }
+    }
+  }
+}
+
+// Point the inputs of a mainImage program at the units the passes bind.
+static void bindProgramInputs(GLint prog) {
+  // Every program reads the same uniform block binding
+  GLuint block = glGetUniformBlockIndex(prog, "ShadertoyInputs");
+  if (block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(prog, block, SHADERTOY_UNIFORM_BINDING);
+  }
+  // iChannelN samples texture unit N
+  for (int c = 0; c < MAX_CHANNELS; c++) {
+    char name[] = "iChannel0";
+    name[8] = '0' + c;
+    GLint loc = glGetUniformLocation(prog, name);
+    if (loc != -1) {
+      glProgramUniform1i(prog, loc, c);
+    }
+  }
+}
+
+// Key of a program variant in the ProgramCache of a context.
+static uint64_t programKey(const char *source, const char *constants,
+                           GLenum format, const GLuint localSize[2]) {
+  uint64_t key = hashString(FNV_OFFSET_BASIS, source);
+  key = hashString(key, constants);
+  key = hashBytes(key, &format, sizeof(format));
+  return hashBytes(key, localSize, 2 * sizeof(GLuint));
+}
+
+// Start building the variant of `request` with the graph's backend.
+static int startRequest(RenderingContext *ctx, ProgramRequest *request) {
+  RenderGraph *graph = &ctx->graph;
+  if (graph->localSize[0] > 0) {
+    return startComputeProgram(&request->pending, request->source,
+                               request->constants, request->format,
+                               graph->localSize);
+  }
+  return startRasterProgram(&request->pending, fullscreen_tri_vs,
+                            request->source, request->constants);
+}
+
+// Requests built by a pool of contexts sharing objects with `ctx`
+typedef struct __CompileHelpers {
+  RenderingContext *ctx;
+  EGLConfig config;
+  ProgramRequest *requests;
+  int count;
+  atomic_int next; // Next request to take
+} CompileHelpers;
+
+// Build requests until none is left, on the context current on this thread.
+static void buildRequests(CompileHelpers *helpers) {
+  int i;
+  while ((i = atomic_fetch_add(&helpers->next, 1)) < helpers->count) {
+    ProgramRequest *request = &helpers->requests[i];
+    if (request->built) {
+      request->prog = startRequest(helpers->ctx, request) == 0
+                          ? finishProgram(&request->pending)
+                          : -1;
+    }
+  }
+}
+
+static void *compileHelper(void *arg) {
+  CompileHelpers *helpers = arg;
+  EGLDisplay dpy = helpers->ctx->eglDpy;
+  EGLContext ctx;
+  EGLSurface surface;
+  // On failure the other threads take this one's share
+  if (createEglContext(dpy, helpers->config, helpers->ctx->ctx, &ctx,
+                       &surface) != 0) {
+    return NULL;
+  }
+  traceThreadName("compile helper");
+  if (eglMakeCurrent(dpy, surface, surface, ctx)) {
+    buildRequests(helpers);
+    // Flushes the programs for the contexts sharing them
+    eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  if (surface != EGL_NO_SURFACE) {
+    eglDestroySurface(dpy, surface);
+  }
+  eglDestroyContext(dpy, ctx);
+  return NULL;
+}
 
-  // Compile vertex shader
-  GLuint vs, fs;
-  compileShader(&vs, GL_VERTEX_SHADER, &vertexShaderSource, 1, NULL);
+/**
+ * Build `count` requests on this thread and `helperCount` helper threads, for
+ * drivers that compile on the calling thread only.
+ */
+static void buildOnHelpers(RenderingContext *ctx, ProgramRequest *requests,
+                           int count, int helperCount) {
+  CompileHelpers helpers = {
+      .ctx = ctx, .requests = requests, .count = count, .next = 0};
+  EGLint id = 0, found = 0;
+  eglQueryContext(ctx->eglDpy, ctx->ctx, EGL_CONFIG_ID, &id);
+  const EGLint attribs[] = {EGL_CONFIG_ID, id, EGL_NONE};
+  if (!eglChooseConfig(ctx->eglDpy, attribs, &helpers.config, 1, &found) ||
+      found == 0) {
+    helperCount = 0;
+  }
+  pthread_t *threads = calloc(helperCount, sizeof(pthread_t));
+  int started = 0;
+  while (threads != NULL && started < helperCount &&
+         pthread_create(&threads[started], NULL, compileHelper, &helpers) ==
+             0) {
+    started++;
+  }
+  buildRequests(&helpers);
+  for (int t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+}
 
-  if (strstr(fragmentShaderSource, "#version") != NULL ||
-      strstr(fragmentShaderSource, "void mainImage") == NULL) {
-    compileShader(&fs, GL_FRAGMENT_SHADER, &fragmentShaderSource, 1, NULL);
+/**
+ * Get the program of every request, building the variants this context does
+ * not have yet all at once: on the driver's compiler threads with
+ * GL_KHR_parallel_shader_compile, otherwise on helper contexts. Returns -1 if
+ * any failed, leaving its prog at -1.
+ */
+static int cachedPrograms(RenderingContext *ctx, ProgramRequest *requests,
+                          int count) {
+  RenderGraph *graph = &ctx->graph;
+  int missing = 0;
+  for (int i = 0; i < count; i++) {
+    ProgramRequest *r = &requests[i];
+    r->prog = -1;
+    r->built = 0;
+    r->constants = shaderConstants(graph->specialize ? r->width : 0,
+                                   graph->specialize ? r->height : 0,
+                                   graph->defines);
+    if (r->constants == NULL) {
+      printf("Failed to allocate shader constants\n");
+      continue;
+    }
+    r->key = programKey(r->source, r->constants, r->format, graph->localSize);
+    r->prog = programCacheFind(&ctx->programs, r->key);
+    if (r->prog == 0) {
+      r->built = 1;
+      missing++;
+    }
+  }
+  double start = monotonic_now();
+  uint64_t span = traceBegin();
+  int helperCount = parallelCompile.threads - 1;
+  helperCount = helperCount < missing - 1 ? helperCount : missing - 1;
+  if (parallelCompile.maxThreads == NULL && helperCount > 0) {
+    buildOnHelpers(ctx, requests, count, helperCount);
   } else {
-    // append header to fragment shader source
-    const char *fragment_shaders[] = {
-        FRAGMENT_SHADER_HEADER,
-        fragmentShaderSource,
-        FRAGMENT_SHADER_MAIN_ENTRY,
+    // Issue every link, then collect them as the driver completes them
+    for (int i = 0; i < count; i++) {
+      if (requests[i].built && startRequest(ctx, &requests[i]) != 0) {
+        requests[i].pending.prog = 0;
+      }
+    }
+    for (int left = missing; left > 0;) {
+      int completed = 0;
+      for (int i = 0; i < count; i++) {
+        ProgramRequest *r = &requests[i];
+        if (!r->built || r->prog != 0) {
+          continue;
+        }
+        if (r->pending.prog == 0) {
+          r->prog = -1;
+        } else if (programCompleted(&parallelCompile, r->pending.prog)) {
+          r->prog = finishProgram(&r->pending);
+        } else {
+          continue;
+        }
+        completed++;
+      }
+      left -= completed;
+      if (left > 0 && completed == 0) {
+        sched_yield();
+      }
+    }
+  }
+  if (missing > 0) {
+    traceEnd("build_programs", NULL, (int)ctx->time.frame, span);
+  }
+  if (missing > 1) {
+    printf("Built %d programs in %.3f ms (%s, %d threads)\n", missing,
+           monotonic_now() - start,
+           parallelCompile.maxThreads != NULL ? "driver" : "helper contexts",
+           parallelCompile.threads);
+  }
+  int result = 0;
+  for (int i = 0; i < count; i++) {
+    ProgramRequest *r = &requests[i];
+    if (r->built && r->prog > 0) {
+      bindProgramInputs(r->prog);
+      if (programCacheAdd(&ctx->programs, r->key, r->prog) != 0) {
+        glDeleteProgram(r->prog);
+        r->prog = -1;
+      }
+    }
+    result = r->prog > 0 ? result : -1;
+    free(r->constants);
+    r->constants = NULL;
+  }
+  return result;
+}
+
+// Compiler and linker messages of `prog`, which failed to link.
+static void printBuildLog(GLuint prog) {
+  GLuint shaders[2];
+  GLsizei count = 0;
+  char text[4096];
+  glGetAttachedShaders(prog, 2, &count, shaders);
+  for (int i = 0; i < count; i++) {
+    glGetShaderInfoLog(shaders[i], sizeof(text), NULL, text);
+    printf("%s", text);
+  }
+  glGetProgramInfoLog(prog, sizeof(text), NULL, text);
+  printf("%s\n", text);
+}
+
+/**
+ * --watch thread: rebuild each pass whose file changed on its own context and
+ * stage the program for the render loop. A build that fails leaves the running
+ * program in place.
+ */
+static void *hotReloadThread(void *arg) {
+  HotReload *reload = arg;
+  RenderJob *job = reload->job;
+  traceThreadName("hot reload");
+  if (!eglMakeCurrent(reload->eglDpy, reload->surface, reload->surface,
+                      reload->ctx)) {
+    checkEglError("eglMakeCurrent");
+    return NULL;
+  }
+  // Passes are built like buildRenderGraph does without --specialize
+  char *constants = shaderConstants(0, 0, job->defines);
+  while (constants != NULL && !atomic_load(&reload->stop) &&
+         !exit_condition) {
+    unsigned int changed = fileWatchWait(&reload->watch, HOT_RELOAD_POLL_MS);
+    for (int p = 0; p < MAX_PASSES; p++) {
+      if ((changed & (1u << p)) == 0) {
+        continue;
+      }
+      const char *file = reload->files[p];
+      double start = monotonic_now();
+      uint64_t span = traceBegin();
+      GLenum format =
+          p == IMAGE_PASS ? job->format->internalFormat : job->bufferFormat;
+      char *source = NULL;
+      // A syntax error is the common case here, print it in any build
+      PendingProgram pending = {.prog = 0, .checkCompile = 1};
+      int started = -1;
+      if (loadShaderSource(file, &source) == 0) {
+        started = job->localSize[0] > 0
+                      ? startComputeProgram(&pending, source, constants,
+                                            format, job->localSize)
+                      : startRasterProgram(&pending, fullscreen_tri_vs,
+                                           source, constants);
+      }
+      GLint linked = GL_TRUE;
+      if (started == 0 && !pending.loaded) {
+        glGetProgramiv(pending.prog, GL_LINK_STATUS, &linked);
+      }
+      if (!linked) {
+        printBuildLog(pending.prog);
+      }
+      GLint prog = started == 0 ? finishProgram(&pending) : -1;
+      if (prog < 0) {
+        printf("%s: build failed, keeping the running program\n", file);
+        free(source);
+        reload->failures++;
+        continue;
+      }
+      bindProgramInputs(prog);
+      // The render context may only use it once it is complete
+      glFinish();
+      reload->rebuilds++;
+      traceEnd("rebuild", passNames[p], -1, span);
+      printf("%s: rebuilt in %.3f ms\n", file, monotonic_now() - start);
+      pthread_mutex_lock(&reload->lock);
+      if (reload->staged[p] > 0) { // Superseded before it was swapped in
+        glDeleteProgram(reload->staged[p]);
+        free(reload->stagedSources[p]);
+      }
+      reload->staged[p] = prog;
+      reload->stagedSources[p] = source;
+      reload->stagedKeys[p] =
+          programKey(source, constants, format, job->localSize);
+      atomic_store(&reload->ready, 1);
+      pthread_mutex_unlock(&reload->lock);
+    }
+  }
+  free(constants);
+  eglMakeCurrent(reload->eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 EGL_NO_CONTEXT);
+  return NULL;
+}
+
+// Swap in the programs staged by the --watch thread, unless it holds them.
+static void applyHotReload(RenderingContext *ctx, HotReload *reload) {
+  if (!atomic_load(&reload->ready) ||
+      pthread_mutex_trylock(&reload->lock) != 0) {
+    return;
+  }
+  RenderGraph *graph = &ctx->graph;
+  // The old programs are deleted, make sure none stays bound
+  useProgram(ctx, 0);
+  for (int p = 0; p < MAX_PASSES; p++) {
+    GraphPass *pass = &graph->passes[p];
+    if (reload->staged[p] <= 0) {
+      continue;
+    }
+    if (programCacheReplace(&ctx->programs, pass->prog.id,
+                            reload->stagedKeys[p], reload->staged[p]) != 0) {
+      glDeleteProgram(reload->staged[p]);
+      free(reload->stagedSources[p]);
+    } else {
+      pass->prog.id = reload->staged[p];
+      free(pass->source);
+      pass->source = reload->stagedSources[p];
+      reload->swaps++;
+    }
+    reload->staged[p] = 0;
+    reload->stagedSources[p] = NULL;
+  }
+  atomic_store(&reload->ready, 0);
+  pthread_mutex_unlock(&reload->lock);
+}
+
+/**
+ * Build the Image pass of --heatmap: timing mainImage per pixel with the
+ * shader clock when the driver has ARB_shader_clock, otherwise the plain pass,
+ * rasterized so it can be drawn and timed one scissored tile at a time.
+ */
+static int prepareHeatmap(RenderingContext *ctx, uint64_t frame) {
+  HeatmapProfile *heatmap = &ctx->heatmap;
+  char *constants = shaderConstants(0, 0, ctx->graph.defines);
+  if (constants == NULL) {
+    return -1;
+  }
+  const char *source = ctx->graph.passes[IMAGE_PASS].source;
+  heatmap->clock = hasGlExtension("GL_ARB_shader_clock");
+  if (heatmap->clock) {
+    const GLenum types[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    const int counts[] = {1, 5};
+    const char *sources[] = {
+        fullscreen_tri_vs,         PROFILE_SHADER_HEADER,
+        SHADERTOY_INPUTS,          constants,
+        source,                    PROFILE_SHADER_MAIN_ENTRY,
     };
+    PendingProgram pending;
+    heatmap->prog = startProgram(&pending, 2, types, sources, counts) == 0
+                        ? finishProgram(&pending)
+                        : -1;
+  } else {
+    heatmap->prog = compileAndLinkProgram(fullscreen_tri_vs, source, constants);
+  }
+  free(constants);
+  if (heatmap->prog < 0) {
+    printf("Failed to build the --heatmap pass\n");
+    return -1;
+  }
+  bindProgramInputs(heatmap->prog);
+  heatmap->frame = frame;
+  printf("Heatmap of frame %llu: %s\n", (unsigned long long)frame,
+         heatmap->clock ? "cycles per pixel (ARB_shader_clock)"
+                        : "time per tile");
+  return 0;
+}
+
+/**
+ * Draw the Image `pass` again with the --heatmap program and write the cost
+ * map next to the frames.
+ */
+static void profileImagePass(RenderingContext *ctx, RenderPass pass) {
+  HeatmapProfile *heatmap = &ctx->heatmap;
+  const GLuint width = pass.rt->width, height = pass.rt->height;
+  float *cost = malloc((size_t)width * height * sizeof(float));
+  if (cost == NULL) {
+    return;
+  }
+  GLProgram prog = {.id = heatmap->prog};
+  pass.prog = &prog;
+  if (heatmap->clock) {
+    // Cycles in the red channel of a float target
+    RenderTarget target = {.fbo = 0};
+    if (acquireRenderTarget(ctx, &target, width, height, GL_RGBA32F) != 0) {
+      free(cost);
+      return;
+    }
+    pass.rt = &target;
+    draw(ctx, pass);
+    glGetTextureImage(target.color0, 0, GL_RED, GL_FLOAT,
+                      width * height * sizeof(float), cost);
+    releaseRenderTarget(ctx, &target);
+  } else {
+    // Redraw each tile of writeHeatmap into the frame, which gets the same
+    // pixels, and spread its time over them. Timer queries would miss the
+    // rasterization of drivers that defer it, like llvmpipe.
+    draw(ctx, pass); // Untimed, the first draw also generates the code
+    glEnable(GL_SCISSOR_TEST);
+    glFinish();
+    for (GLuint y0 = 0; y0 < height; y0 += HEATMAP_TILE_SIZE) {
+      GLuint y1 = y0 + HEATMAP_TILE_SIZE < height ? y0 + HEATMAP_TILE_SIZE
+                                                  : height;
+      for (GLuint x0 = 0; x0 < width; x0 += HEATMAP_TILE_SIZE) {
+        GLuint x1 = x0 + HEATMAP_TILE_SIZE < width ? x0 + HEATMAP_TILE_SIZE
+                                                   : width;
+        // Tiles are counted from the top, GL rows from the bottom
+        glScissor(x0, height - y1, x1 - x0, y1 - y0);
+        double start = monotonic_now();
+        draw(ctx, pass);
+        glFinish();
+        float perPixel = (float)((monotonic_now() - start) * 1e6) /
+                         ((x1 - x0) * (y1 - y0));
+        for (GLuint row = height - y1; row < height - y0; row++) {
+          for (GLuint x = x0; x < x1; x++) {
+            cost[(size_t)row * width + x] = perPixel;
+          }
+        }
+      }
+    }
+    glDisable(GL_SCISSOR_TEST);
+  }
+  const char *dir = ctx->output->dir, *name = ctx->output->name;
+  size_t len = strlen(dir) + strlen(name) + 32;
+  char *path = malloc(len);
+  if (path != NULL) {
+    snprintf(path, len, "%s/%s_heatmap_%04d", dir, name, ctx->time.frame);
+    writeHeatmap(path, cost, width, height,
+                 heatmap->clock ? "cycles" : "ns");
+  }
+  free(path);
+  free(cost);
+}
+
+// Switch the passes to the variants for the current sizes, after a rescale.
+static int specializeRenderGraph(RenderingContext *ctx) {
+  RenderGraph *graph = &ctx->graph;
+  ProgramRequest requests[MAX_PASSES];
+  for (int k = 0; k < graph->count; k++) {
+    int p = graph->order[k];
+    GraphPass *pass = &graph->passes[p];
+    ProgramRequest request = {.source = pass->source};
+    if (p == IMAGE_PASS) {
+      request.format = ctx->renderTarget.format;
+      request.width = ctx->frameSize[0];
+      request.height = ctx->frameSize[1];
+    } else {
+      request.format = graph->bufferFormat;
+      request.width = pass->targets[0].width;
+      request.height = pass->targets[0].height;
+    }
+    requests[k] = request;
+  }
+  cachedPrograms(ctx, requests, graph->count);
+  for (int k = 0; k < graph->count; k++) {
+    int p = graph->order[k];
+    if (requests[k].prog < 0) {
+      printf("Failed to build pass %s\n", passNames[p]);
+      return -1;
+    }
+    graph->passes[p].prog.id = requests[k].prog;
+  }
+  return 0;
+}
 
-    GLint fragment_lengths[] = {
-        (GLint)strlen(FRAGMENT_SHADER_HEADER),
-        (GLint)strlen(fragmentShaderSource),
-        (GLint)strlen(FRAGMENT_SHADER_MAIN_ENTRY),
+/**
+ * Compile every declared pass, resolve the execution order and allocate the
+ * buffer targets at the size of `output`, which the Image pass renders into.
+ */
+static int buildRenderGraph(RenderingContext *ctx, const RenderTarget *output) {
+  RenderGraph *graph = &ctx->graph;
+  ProgramRequest requests[MAX_PASSES];
+  int passes[MAX_PASSES];
+  int count = 0;
+  for (int p = 0; p < MAX_PASSES; p++) {
+    GraphPass *pass = &graph->passes[p];
+    if (pass->source == NULL) {
+      continue;
+    }
+    // Buffers render at the size of the output, the Image pass at the frame
+    ProgramRequest request = {
+        .source = pass->source,
+        .format = p == IMAGE_PASS ? output->format : graph->bufferFormat,
+        .width = p == IMAGE_PASS ? ctx->frameSize[0] : output->width,
+        .height = p == IMAGE_PASS ? ctx->frameSize[1] : output->height,
     };
-    compileShader(&fs, GL_FRAGMENT_SHADER, fragment_shaders, 3,
-                  fragment_lengths);
+    passes[count] = p;
+    requests[count++] = request;
   }
-  if (vs == 0 || fs == 0) {
-    log("Failed to compile shaders\n");
-    glDeleteProgram(prog);
+  // Every pass compiles at once
+  cachedPrograms(ctx, requests, count);
+  for (int i = 0; i < count; i++) {
+    GraphPass *pass = &graph->passes[passes[i]];
+    if (requests[i].prog < 0) {
+      printf("Failed to build pass %s\n", passNames[passes[i]]);
+      return -1;
+    }
+    pass->prog.id = requests[i].prog;
+    memcpy(pass->prog.localSize, graph->localSize, sizeof(graph->localSize));
+  }
+  for (int p = 0; p < MAX_PASSES; p++) {
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      int src = graph->passes[p].channels[c];
+      if (graph->passes[p].prog.id > 0 && src >= 0 &&
+          graph->passes[src].prog.id <= 0) {
+        printf("Pass %s reads Buffer %s, which has no shader\n",
+               passNames[p], passNames[src]);
+        return -1;
+      }
+    }
+  }
+  sortRenderGraph(graph);
+  GLint align = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+  graph->uniformStride =
+      (sizeof(ShadertoyUniforms) + align - 1) / align * align;
+  graph->uniformData = calloc(graph->count, graph->uniformStride);
+  if (!graph->uniformData) {
+    printf("Failed to allocate uniform data\n");
     return -1;
   }
-  // Link program
-  glAttachShader(prog, fs);
-  glAttachShader(prog, vs);
-  glLinkProgram(prog);
-  GLint linkStatus;
-  glGetProgramiv(prog, GL_LINK_STATUS, &linkStatus);
-  if (linkStatus == GL_FALSE) {
-    GLint logLength;
-    glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &logLength);
-    char *logstr = calloc(logLength + 1, sizeof(char));
-    glGetProgramInfoLog(prog, logLength, NULL, logstr);
-    log("Failed to link program, log:\n%s\n", logstr);
-    free(logstr);
-    glDeleteProgram(prog);
-    prog = -1;
-    goto fail;
+  glCreateBuffers(1, &graph->uniformBuffer);
+  glNamedBufferStorage(graph->uniformBuffer,
+                       graph->count * graph->uniformStride, NULL,
+                       GL_DYNAMIC_STORAGE_BIT);
+  for (int k = 0; k < graph->count; k++) {
+    int p = graph->order[k];
+    GraphPass *pass = &graph->passes[p];
+    log("Pass %d: %s%s\n", k, passNames[p],
+        pass->feedback ? " (feedback)" : "");
+    for (int t = 0; p != IMAGE_PASS && t < 1 + pass->feedback; t++) {
+      if (acquireRenderTarget(ctx, &pass->targets[t], output->width,
+                              output->height, graph->bufferFormat) != 0) {
+        return -1;
+      }
+    }
+  }
+  checkGLError("After building render graph");
+  return 0;
+}
+
+/**
+ * Fill the inputs of every pass and upload them in one call. Only iResolution,
+ * iChannelResolution and iTileOffset differ between passes.
+ */
+static void updateRenderGraphUniforms(RenderingContext *ctx) {
+  RenderGraph *graph = &ctx->graph;
+  ShadertoyUniforms frame;
+  shadertoyFrameUniforms(&ctx->time, &frame);
+  for (int k = 0; k < graph->count; k++) {
+    int p = graph->order[k];
+    GraphPass *pass = &graph->passes[p];
+    ShadertoyUniforms *u =
+        (ShadertoyUniforms *)(graph->uniformData + k * graph->uniformStride);
+    *u = frame;
+    if (p == IMAGE_PASS) {
+      // The output may be one tile: shade it at its place in the frame
+      u->iResolution[0] = ctx->frameSize[0];
+      u->iResolution[1] = ctx->frameSize[1];
+      u->iTileOffset[0] = ctx->tileOrigin[0];
+      u->iTileOffset[1] = ctx->tileOrigin[1];
+    } else {
+      u->iResolution[0] = pass->targets[0].width;
+      u->iResolution[1] = pass->targets[0].height;
+    }
+    u->iResolution[2] = 1.0f;
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      int src = pass->channels[c];
+      if (src < 0) {
+        continue;
+      }
+      const RenderTarget *in = &graph->passes[src].targets[0];
+      u->iChannelTime[c][0] = frame.iTime;
+      u->iChannelResolution[c][0] = in->width;
+      u->iChannelResolution[c][1] = in->height;
+      u->iChannelResolution[c][2] = 1.0f;
+    }
+  }
+  glNamedBufferSubData(graph->uniformBuffer, 0,
+                       graph->count * graph->uniformStride, graph->uniformData);
+}
+
+// Run every pass once in dependency order; the Image pass draws to `output`.
+static void renderGraphFrame(RenderingContext *ctx, RenderTarget *output) {
+  RenderGraph *graph = &ctx->graph;
+  double start = monotonic_now();
+  uint64_t span = traceBegin();
+  updateRenderGraphUniforms(ctx);
+  traceEnd("uniforms", NULL, (int)ctx->time.frame, span);
+  double drawStart = monotonic_now();
+  for (int k = 0; k < graph->count; k++) {
+    int p = graph->order[k];
+    GraphPass *pass = &graph->passes[p];
+    RenderPass rp = {
+        .prog = &pass->prog,
+        .rt = p == IMAGE_PASS ? output : &pass->targets[pass->write],
+        .uniforms = k * graph->uniformStride,
+    };
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      int src = pass->channels[c];
+      if (src < 0) {
+        continue;
+      }
+      GraphPass *in = &graph->passes[src];
+      // This frame's output if it already ran, else the previous frame's
+      int t = (in->feedback && !in->executed) ? in->write ^ 1 : in->write;
+      rp.channels[c] = in->targets[t].color0;
+    }
+    span = traceBegin();
+    passQueryBegin(&ctx->queries, p, pass->prog.localSize[0] > 0);
+    draw(ctx, rp);
+    passQueryEnd(&ctx->queries, pass->prog.localSize[0] > 0);
+    traceEnd("draw", passNames[p], (int)ctx->time.frame, span);
+    if (p == IMAGE_PASS && ctx->heatmap.frame == ctx->time.frame) {
+      profileImagePass(ctx, rp);
+    }
+    pass->executed = 1;
+  }
+  if (ctx->report != NULL) {
+    benchRecord(ctx->report, STAGE_UNIFORMS, drawStart - start);
+    benchRecord(ctx->report, STAGE_DRAW, monotonic_now() - drawStart);
+  }
+  for (int p = 0; p < MAX_PASSES; p++) {
+    GraphPass *pass = &graph->passes[p];
+    pass->executed = 0;
+    if (pass->feedback) {
+      pass->write ^= 1; // Ping-pong
+    }
+  }
+}
+
+// Print the GPU time and invocations of each pass measured by --gpu-queries.
+static void printPassQueries(const PassQueries *q, int context) {
+  for (int p = 0; p < q->passes && p < MAX_PASSES; p++) {
+    const PassStats *stats = &q->stats[p];
+    if (stats->frames == 0) {
+      continue;
+    }
+    printf("GPU pass %s (context %d): %llu frames, %.3f ms mean, %.3f ms max",
+           passNames[p], context, stats->frames,
+           stats->totalMs / stats->frames, stats->maxMs);
+    if (q->statistics) {
+      printf(", %llu %s invocations/frame", stats->invocations / stats->frames,
+             stats->compute ? "compute" : "fragment");
+    }
+    printf("\n");
+  }
+  if (q->skipped > 0) {
+    printf("GPU queries (context %d): %llu frames not measured, every slot "
+           "was in flight\n",
+           context, q->skipped);
+  }
+}
+
+static void destroyRenderGraph(RenderingContext *ctx) {
+  RenderGraph *graph = &ctx->graph;
+  useProgram(ctx, 0);
+  bindUniforms(ctx, 0, 0);
+  glDeleteBuffers(1, &graph->uniformBuffer);
+  free(graph->uniformData);
+  for (int p = 0; p < MAX_PASSES; p++) {
+    GraphPass *pass = &graph->passes[p];
+    for (int t = 0; t < 2; t++) {
+      releaseRenderTarget(ctx, &pass->targets[t]);
+    }
+    free(pass->source);
   }
-fail:
-  // Clean up shaders after linking
-  glDeleteShader(vs);
-  glDeleteShader(fs);
-  return prog;
+  programCacheDestroy(&ctx->programs);
+  memset(graph, 0, sizeof(*graph));
 }
 
 static int prepareRenderingContext(RenderingContext **ctx, EGLDisplay eglDpy,
-                                   EGLContext eglCtx, EGLSurface surface) {
+                                   EGLContext eglCtx, EGLSurface surface,
+                                   GLuint width, GLuint height,
+                                   const PixelFormat *format) {
   RenderingContext renderingCtx = {
       .eglDpy = eglDpy,
       .ctx = eglCtx,
-      .renderTarget =
-          {
-              .fbo = 0,
-              .width = 1920,  // Default width
-              .height = 1080, // Default height
-              .color0 = 0,    // Texture for render target
-          },
-      .frameCount = 0,
-      .pbo = {0, 0, 0}, // Pixel Buffer Objects for readback
+      .renderTarget = {.fbo = 0}, // Acquired below
+      .format = format,
+      .frameSize = {width, height},
+      .time = {.frame = 0},
+      .readback = {.count = 0}, // Created on first readback
+      .output = NULL,
   };
+  *ctx = malloc(sizeof(RenderingContext));
+  if (!*ctx) {
+    printf("Failed to allocate memory for rendering context\n");
+    return -1;
+  }
+  **ctx = renderingCtx;
 
   // Create default framebuffer object (FBO) as render target
-  glGenFramebuffers(1, &renderingCtx.renderTarget.fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, renderingCtx.renderTarget.fbo);
-  // Create a texture for rendering
-  glActiveTexture(GL_TEXTURE0);
-  glGenTextures(1, &renderingCtx.renderTarget.color0);
-  // Bind the texture to the FBO
-  glBindTexture(GL_TEXTURE_2D, renderingCtx.renderTarget.color0);
-  // Allocate storage for the texture
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, renderingCtx.renderTarget.width,
-                 renderingCtx.renderTarget.height);
-  // Attach the color texture to the FBO
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         renderingCtx.renderTarget.color0, 0);
-
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    printf("Failed to create framebuffer\n");
+  if (acquireRenderTarget(*ctx, &(*ctx)->renderTarget, width, height,
+                          format->internalFormat) != 0) {
     return -1;
   }
+  parallelCompileContext(&parallelCompile);
   // glDrawBuffer(GL_COLOR_ATTACHMENT0);
   glDisable(GL_DEPTH_TEST); // no depth buffer for this test
   // glEnable(GL_BLEND); // Enable blending
   // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Set blend function
   checkGLError("After creating framebuffer");
-  *ctx = malloc(sizeof(RenderingContext));
-  if (!*ctx) {
-    printf("Failed to allocate memory for rendering context\n");
+  return 0;
+}
+
+static const GLfloat clearColor[] = {0.f, 0.f, 0.f, 1.0f};
+static int createRenderTarget(RenderTarget *rt, GLuint width, GLuint height,
+                              GLenum internalFormat) {
+  rt->width = width;
+  rt->height = height;
+  rt->format = internalFormat;
+  // Direct state access, so the bindings tracked in GLStateCache stay valid
+  glCreateFramebuffers(1, &rt->fbo);
+  // Create a texture for rendering
+  glCreateTextures(GL_TEXTURE_2D, 1, &rt->color0);
+  // Allocate storage for the texture
+  glTextureStorage2D(rt->color0, 1, internalFormat, width, height);
+  glTextureParameteri(rt->color0, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(rt->color0, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(rt->color0, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(rt->color0, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  // Attach the color texture to the FBO
+  glNamedFramebufferTexture(rt->fbo, GL_COLOR_ATTACHMENT0, rt->color0, 0);
+
+  if (glCheckNamedFramebufferStatus(rt->fbo, GL_FRAMEBUFFER) !=
+      GL_FRAMEBUFFER_COMPLETE) {
+    printf("Failed to create framebuffer\n");
     return -1;
   }
-  **ctx = renderingCtx;
+  glClearNamedFramebufferfv(rt->fbo, GL_COLOR, 0, clearColor);
+  return 0;
+}
+
+static void destroyRenderTarget(RenderingContext *ctx, RenderTarget *rt) {
+  // Deleting bound objects reverts their bindings to 0
+  if (ctx->state.fbo == rt->fbo) {
+    ctx->state.fbo = 0;
+  }
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    if (ctx->state.textures[i] == rt->color0) {
+      ctx->state.textures[i] = 0;
+    }
+  }
+  glDeleteFramebuffers(1, &rt->fbo);
+  glDeleteTextures(1, &rt->color0);
+  rt->fbo = rt->color0 = 0;
+  rt->width = rt->height = 0;
+}
+
+/**
+ * Get a cleared `width` x `height` render target of `internalFormat`, reusing
+ * a released one of the same shape when the pool has one.
+ */
+static int acquireRenderTarget(RenderingContext *ctx, RenderTarget *rt,
+                               GLuint width, GLuint height,
+                               GLenum internalFormat) {
+  RenderTargetPool *pool = &ctx->targetPool;
+  for (int i = 0; i < pool->count; i++) {
+    RenderTarget *cached = &pool->targets[i];
+    if (cached->width == width && cached->height == height &&
+        cached->format == internalFormat) {
+      *rt = *cached;
+      *cached = pool->targets[--pool->count];
+      glClearNamedFramebufferfv(rt->fbo, GL_COLOR, 0, clearColor);
+      pool->reused++;
+      return 0;
+    }
+  }
+  pool->created++;
+  return createRenderTarget(rt, width, height, internalFormat);
+}
+
+// Return `rt` to the pool, or destroy it if the pool is full.
+static void releaseRenderTarget(RenderingContext *ctx, RenderTarget *rt) {
+  RenderTargetPool *pool = &ctx->targetPool;
+  if (rt->fbo == 0) {
+    return;
+  }
+  if (pool->count == RENDER_TARGET_POOL_SIZE) {
+    destroyRenderTarget(ctx, rt);
+    return;
+  }
+  pool->targets[pool->count++] = *rt;
+  memset(rt, 0, sizeof(*rt));
+}
+
+// Move `rt` to a new size, keeping its contents (feedback buffers' history).
+static int resizeRenderTarget(RenderingContext *ctx, RenderTarget *rt,
+                              GLuint width, GLuint height) {
+  RenderTarget resized;
+  if (acquireRenderTarget(ctx, &resized, width, height, rt->format) != 0) {
+    return -1;
+  }
+  glBlitNamedFramebuffer(rt->fbo, resized.fbo, 0, 0, rt->width, rt->height, 0,
+                         0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  releaseRenderTarget(ctx, rt);
+  *rt = resized;
+  return 0;
+}
+
+/**
+ * Resize the internal render target and the graph's buffers to the current
+ * dynamic resolution scale. At scale 1 the graph renders straight into the
+ * output target again.
+ */
+static int applyRenderScale(RenderingContext *ctx) {
+  GLuint width = dynresScaled(&ctx->dynres, ctx->renderTarget.width);
+  GLuint height = dynresScaled(&ctx->dynres, ctx->renderTarget.height);
+  releaseRenderTarget(ctx, &ctx->scaledTarget);
+  if (ctx->dynres.scale < 1.0f &&
+      acquireRenderTarget(ctx, &ctx->scaledTarget, width, height,
+                          ctx->renderTarget.format) != 0) {
+    return -1;
+  }
+  ctx->frameSize[0] = width;
+  ctx->frameSize[1] = height;
+  for (int p = 0; p < IMAGE_PASS; p++) {
+    for (int t = 0; t < 2; t++) {
+      RenderTarget *rt = &ctx->graph.passes[p].targets[t];
+      if (rt->fbo != 0 && resizeRenderTarget(ctx, rt, width, height) != 0) {
+        return -1;
+      }
+    }
+  }
+  checkGLError("After applying render scale");
+  return 0;
+}
+
+// Bilinear upscale of the scaled render target to the output size.
+static void upscaleToOutput(RenderingContext *ctx, RenderTarget *src) {
+  RenderTarget *dst = &ctx->renderTarget;
+  glBlitNamedFramebuffer(src->fbo, dst->fbo, 0, 0, src->width, src->height, 0,
+                         0, dst->width, dst->height, GL_COLOR_BUFFER_BIT,
+                         GL_LINEAR);
+}
+
+static void drainRenderTargetPool(RenderingContext *ctx) {
+  RenderTargetPool *pool = &ctx->targetPool;
+  log("Render targets: %u created, %u reused\n", pool->created, pool->reused);
+  while (pool->count > 0) {
+    destroyRenderTarget(ctx, &pool->targets[--pool->count]);
+  }
+}
+
+// (Re)create the conversion program and the R8 plane target for `src`.
+static int prepareYuvPass(RenderingContext *ctx, YuvPass *pass,
+                          const RenderTarget *src) {
+  if (src->width % 2 != 0 || src->height % 2 != 0) {
+    printf("YUV 4:2:0 output needs an even size, got %ux%u\n", src->width,
+           src->height);
+    return -1;
+  }
+  if (pass->prog <= 0) {
+    pass->prog = compileAndLinkProgram(fullscreen_tri_vs, rgb_to_yuv_fs, NULL);
+    if (pass->prog < 0) {
+      return -1;
+    }
+    GLuint prog = pass->prog;
+    glProgramUniform1i(prog, glGetUniformLocation(prog, "nv12"),
+                       pass->layout == YUV_NV12);
+    glProgramUniform3fv(prog, glGetUniformLocation(prog, "rows"), 3,
+                        &pass->coeffs.m[0][0]);
+    glProgramUniform3fv(prog, glGetUniformLocation(prog, "offset"), 1,
+                        pass->coeffs.offset);
+  }
+  glProgramUniform2i(pass->prog, glGetUniformLocation(pass->prog, "srcSize"),
+                     src->width, src->height);
+  releaseRenderTarget(ctx, &pass->target);
+  if (acquireRenderTarget(ctx, &pass->target, src->width, src->height * 3 / 2,
+                          GL_R8) != 0) {
+    return -1;
+  }
+  checkGLError("After preparing YUV pass");
   return 0;
 }
 
@@ -0,0 +1,208 @@
+/**
+ * sink.h - Stream read back frames to stdout or a named pipe.
+ *
+ * Two container formats are supported:
+ *   - rawvideo: tightly packed top-down frames, no headers. The read back
+ *     pixels (RGBA, gray or 16-bit RGBA), or the yuv420p/nv12 planes produced
+ *     by the GPU conversion pass
+ *     (ffmpeg -f rawvideo -pix_fmt rgba -s WxH -r FPS -i -)
+ *   - YUV4MPEG2 4:2:0, converted on the CPU unless the GPU pass already did
+ *     (ffmpeg -f yuv4mpegpipe -i -)
+ *
+ * streamEncode is an EncodeFunc, so conversion and the (possibly blocking)
+ * pipe writes run on an encoder thread. The pool must have a single worker to
+ * keep frames in order.
+ */
+#pragma once
+#include "encoder.h"
+#include "yuv.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // Linux UIO_MAXIOV
+#endif
+
+typedef enum __StreamFormat {
+  STREAM_RAW_RGBA,
+  STREAM_Y4M,
+} StreamFormat;
+
+typedef struct __FrameStream {
+  int fd;
+  StreamFormat format;
+  int fps;
+  YuvLayout layout;       // Layout of submitted frames
+  size_t bytesPerPixel;   // Of rawvideo frames when layout is YUV_NONE
+  YuvCoefficients yuv;    // CPU conversion when layout is YUV_NONE
+  int fullRange;
+  int headerWritten;
+  int failed;             // Set once a write fails (e.g. reader went away)
+  unsigned char *scratch; // Converted frame for Y4M
+  size_t scratchSize;
+  uint64_t frames;
+} FrameStream;
+
+static int parseStreamFormat(const char *name, StreamFormat *format) {
+  if (strcmp(name, "y4m") == 0)
+    *format = STREAM_Y4M;
+  else if (strcmp(name, "rgba") == 0)
+    *format = STREAM_RAW_RGBA;
+  else
+    return -1;
+  return 0;
+}
+
+/**
+ * Open `path` for streaming, "-" means stdout. When streaming to stdout, the
+ * original stdout is kept for frames and fd 1 is pointed at stderr, so the
+ * program's own printf output cannot corrupt the stream.
+ *
+ * Frames are submitted in `layout`; Y4M needs RGBA or I420.
+ */
+static int streamOpen(FrameStream *stream, const char *path,
+                      StreamFormat format, int fps, YuvLayout layout,
+                      YuvMatrix matrix, int fullRange) {
+  memset(stream, 0, sizeof(*stream));
+  stream->format = format;
+  stream->fps = fps > 0 ? fps : 30;
+  stream->layout = layout;
+  stream->bytesPerPixel = 4; // RGBA
+  stream->fullRange = fullRange;
+  yuvCoefficients(matrix, fullRange, &stream->yuv);
+  if (format == STREAM_Y4M && layout == YUV_NV12) {
+    fprintf(stderr, "YUV4MPEG2 cannot carry NV12, use --yuv=i420 or "
+                    "--stream-format=rgba\n");
+    return -1;
+  }
+  if (strcmp(path, "-") == 0) {
+    fflush(stdout);
+    stream->fd = dup(STDOUT_FILENO);
+    if (stream->fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+      perror("Failed to redirect stdout");
+      return -1;
+    }
+  } else {
+    // Blocks until a reader opens the other end if path is a FIFO.
+    stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stream->fd < 0) {
+      perror("Failed to open stream output");
+      return -1;
+    }
+  }
+  // Report EPIPE instead of being killed when the reader exits.
+  signal(SIGPIPE, SIG_IGN);
+  return 0;
+}
+
+static void streamClose(FrameStream *stream) {
+  if (stream->fd >= 0)
+    close(stream->fd);
+  free(stream->scratch);
+  stream->fd = -1;
+  stream->scratch = NULL;
+}
+
+static int streamWritev(FrameStream *stream, struct iovec *iov, int count) {
+  while (count > 0) {
+    int batch = count < IOV_MAX ? count : IOV_MAX;
+    ssize_t n = writev(stream->fd, iov, batch);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Failed to write frame to stream");
+      stream->failed = 1;
+      return -1;
+    }
+    // Skip fully written vectors and trim a partially written one.
+    while (batch > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+      batch--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+static int streamWrite(FrameStream *stream, const void *data, size_t size) {
+  struct iovec iov = {.iov_base = (void *)data, .iov_len = size};
+  return streamWritev(stream, &iov, 1);
+}
+
+static int streamWriteY4M(FrameStream *stream, const EncodeJob *job) {
+  const unsigned int w = job->width, h = job->height;
+  const size_t size = yuv420Size(w, h);
+  if (!stream->headerWritten) {
+    char header[128];
+    int len = snprintf(header, sizeof(header),
+                       "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg "
+                       "XCOLORRANGE=%s\n",
+                       w, h, stream->fps,
+                       stream->fullRange ? "FULL" : "LIMITED");
+    if (streamWrite(stream, header, len) != 0)
+      return -1;
+    stream->headerWritten = 1;
+  }
+  if (stream->layout == YUV_I420) {
+    // Already converted on the GPU
+    struct iovec iov[2] = {
+        {.iov_base = "FRAME\n", .iov_len = 6},
+        {.iov_base = job->buffer->data, .iov_len = size},
+    };
+    return streamWritev(stream, iov, 2);
+  }
+  if (stream->scratchSize != size) {
+    free(stream->scratch);
+    stream->scratch = malloc(size);
+    stream->scratchSize = stream->scratch ? size : 0;
+    if (!stream->scratch)
+      return -1;
+  }
+  rgbaToI420(job->buffer->data, w, h, &stream->yuv, stream->scratch);
+  struct iovec iov[2] = {
+      {.iov_base = "FRAME\n", .iov_len = 6},
+      {.iov_base = stream->scratch, .iov_len = size},
+  };
+  return streamWritev(stream, iov, 2);
+}
+
+static int streamWriteRaw(FrameStream *stream, const EncodeJob *job) {
+  const unsigned int w = job->width, h = job->height;
+  if (stream->layout != YUV_NONE) // Planes are already top-down
+    return streamWrite(stream, job->buffer->data, yuv420Size(w, h));
+  struct iovec *iov = malloc(h * sizeof(struct iovec));
+  if (!iov)
+    return -1;
+  // Flip rows on the fly: GL rows are bottom-up.
+  const size_t stride = (size_t)w * stream->bytesPerPixel;
+  for (unsigned int y = 0; y < h; y++) {
+    iov[y].iov_base = job->buffer->data + (h - 1 - y) * stride;
+    iov[y].iov_len = stride;
+  }
+  int ret = streamWritev(stream, iov, h);
+  free(iov);
+  return ret;
+}
+
+// EncodeFunc: append the job's frame to the stream.
+static void streamEncode(void *user, const EncodeJob *job) {
+  FrameStream *stream = user;
+  if (stream->failed)
+    return;
+  int ret = stream->format == STREAM_Y4M ? streamWriteY4M(stream, job)
+                                         : streamWriteRaw(stream, job);
+  if (ret == 0)
+    stream->frames++;
+}
@@ -0,0 +1,102 @@
+/**
+ * specialize.h - Compile-time specialization of mainImage programs.
+ *
+ * A constant set is GLSL text inserted between the Shadertoy inputs and the
+ * shader source. `#define iResolution vec3(...)` replaces the uniform with
+ * literals the compiler can fold, and --define parameters become macros.
+ * Programs are cached by a hash of the source, the constant set and the build
+ * options, so each variant is compiled once per context.
+ *
+ * Include after glad/gl.h.
+ */
+#pragma once
+#include "hash.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Constant set of a pass rendering `width` x `height`, 0 to keep iResolution
+ * a uniform, followed by the `defines` lines (may be NULL). Returns a string
+ * to free, or NULL if out of memory.
+ */
+static char *shaderConstants(GLuint width, GLuint height,
+                             const char *defines) {
+  defines = defines != NULL ? defines : "";
+  size_t size = 64 + strlen(defines);
+  char *text = malloc(size);
+  if (text == NULL)
+    return NULL;
+  int n = 0;
+  if (width > 0)
+    n = snprintf(text, size, "#define iResolution vec3(%u.0, %u.0, 1.0)\n",
+                 width, height);
+  snprintf(text + n, size - n, "%s", defines);
+  return text;
+}
+
+typedef struct __ProgramCacheEntry {
+  uint64_t key;
+  GLint prog;
+} ProgramCacheEntry;
+
+typedef struct __ProgramCache {
+  ProgramCacheEntry *entries; // Owns the programs
+  int count;
+  int capacity;
+  uint64_t hits;
+  uint64_t misses;
+} ProgramCache;
+
+// Program built for `key`, 0 if it has not been built yet.
+static GLint programCacheFind(ProgramCache *cache, uint64_t key) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].key == key) {
+      cache->hits++;
+      return cache->entries[i].prog;
+    }
+  }
+  cache->misses++;
+  return 0;
+}
+
+static int programCacheAdd(ProgramCache *cache, uint64_t key, GLint prog) {
+  if (cache->count == cache->capacity) {
+    int capacity = cache->capacity > 0 ? cache->capacity * 2 : 8;
+    ProgramCacheEntry *entries =
+        realloc(cache->entries, capacity * sizeof(ProgramCacheEntry));
+    if (entries == NULL)
+      return -1;
+    cache->entries = entries;
+    cache->capacity = capacity;
+  }
+  ProgramCacheEntry entry = {.key = key, .prog = prog};
+  cache->entries[cache->count++] = entry;
+  return 0;
+}
+
+// Delete every cached program, the context that built them must be current.
+static void programCacheDestroy(ProgramCache *cache) {
+  for (int i = 0; i < cache->count; i++)
+    glDeleteProgram(cache->entries[i].prog);
+  free(cache->entries);
+  memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * Replace the program `old` with `prog` built for `key`, deleting `old`. The
+ * context that uses them must be current.
+ */
+static int programCacheReplace(ProgramCache *cache, GLint old, uint64_t key,
+                               GLint prog) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].prog == old) {
+      glDeleteProgram(old);
+      cache->entries[i].key = key;
+      cache->entries[i].prog = prog;
+      return 0;
+    }
+  }
+  return programCacheAdd(cache, key, prog);
+}
@@ -0,0 +1,109 @@
+/**
+ * timeline.h - Map frame indices to Shadertoy time uniforms.
+ *
+ * In fixed mode iTime and iTimeDelta come from the frame index alone, so a
+ * frame renders the same whatever the speed of the GPU, the context that
+ * rendered it or the order frames were rendered in. Real-time mode follows
+ * the wall clock like the Shadertoy website does. iDate follows iTime from
+ * a date given on the command line, or in real-time mode from the local time
+ * at the first frame.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define TIMELINE_DEFAULT_DATE "2000-01-01" // iDate of frame 1 in fixed mode
+
+typedef enum __TimelineMode {
+  TIMELINE_FIXED,    // iTime = startTime + (frame - 1) / fps
+  TIMELINE_REALTIME, // iTime = startTime + seconds since the first frame
+} TimelineMode;
+
+typedef struct __Timeline {
+  TimelineMode mode;
+  int fps;          // Frames per second of the fixed timestep
+  double startTime; // iTime of frame 1, in seconds
+  double epoch;     // Local date in seconds since 1970 at iTime 0, for iDate
+} Timeline;
+
+// Time uniforms of one frame
+typedef struct __FrameTime {
+  int frame;        // iFrame, 1 for the first frame
+  double time;      // iTime, in seconds
+  double timeDelta; // iTimeDelta, in seconds
+  double frameRate; // iFrameRate, in frames per second
+  double date;      // Local date in seconds since 1970, for iDate
+} FrameTime;
+
+static int parseTimelineMode(const char *name, TimelineMode *mode) {
+  if (strcmp(name, "fixed") == 0)
+    *mode = TIMELINE_FIXED;
+  else if (strcmp(name, "realtime") == 0)
+    *mode = TIMELINE_REALTIME;
+  else
+    return -1;
+  return 0;
+}
+
+/**
+ * Parse "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM:SS" into seconds since 1970, taken
+ * as the local date as is, with no time zone applied. Returns -1 for a date
+ * that does not exist.
+ */
+static int parseTimelineDate(const char *s, double *seconds) {
+  struct tm tm = {0};
+  int end = 0;
+  int n = sscanf(s, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &end);
+  if (n == 3 && s[end] == 'T') {
+    s += end;
+    end = 0;
+    n += sscanf(s, "T%d:%d:%d%n", &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &end);
+  }
+  if ((n != 3 && n != 6) || s[end] != '\0' || tm.tm_mon < 1 || tm.tm_mon > 12 ||
+      tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour < 0 ||
+      tm.tm_hour > 23 || tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0 ||
+      tm.tm_sec > 59)
+    return -1;
+  struct tm given = tm;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  time_t t = timegm(&tm);
+  // timegm normalizes days past the end of the month, e.g. February 30
+  if (tm.tm_year != given.tm_year - 1900 || tm.tm_mon != given.tm_mon - 1 ||
+      tm.tm_mday != given.tm_mday)
+    return -1;
+  *seconds = (double)t;
+  return 0;
+}
+
+// The wall clock as a local date in seconds since 1970.
+static double timelineLocalNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  struct tm tm;
+  localtime_r(&ts.tv_sec, &tm);
+  return (double)(ts.tv_sec + tm.tm_gmtoff) + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Time of `frame` (1-based). `elapsed` is the wall-clock time in seconds since
+ * frame 1 and `previous` the time of the last frame rendered on this context;
+ * both are ignored in fixed mode.
+ */
+static void timelineFrame(const Timeline *timeline, uint64_t frame,
+                          double elapsed, const FrameTime *previous,
+                          FrameTime *out) {
+  FrameTime t = {.frame = (int)frame};
+  if (timeline->mode == TIMELINE_FIXED) {
+    t.time = timeline->startTime + (double)(frame - 1) / timeline->fps;
+    t.timeDelta = 1.0 / timeline->fps;
+  } else {
+    t.time = timeline->startTime + elapsed;
+    t.timeDelta = frame > 1 ? t.time - previous->time : 0.0;
+  }
+  t.frameRate = t.timeDelta > 0.0 ? 1.0 / t.timeDelta : timeline->fps;
+  t.date = timeline->epoch + t.time;
+  *out = t; // `out` may alias `previous`
+}
@@ -0,0 +1,147 @@
+/**
+ * trace.h - Chrome trace-event recording of the render pipeline (--trace).
+ *
+ * Each traced span is one complete ("X") event: its name, start, duration,
+ * thread and frame. Events go into a ring allocated and touched up front.
+ * Recording one takes two clock reads and an atomic increment, with no locks,
+ * allocations or I/O. Once the ring is full, the oldest events are overwritten.
+ * traceWrite dumps the ring at exit as JSON for chrome://tracing or Perfetto.
+ * Recording works in release builds and has no link to log().
+ */
+#pragma once
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_DEFAULT_EVENTS (1u << 18) // 10 MB
+#define TRACE_MAX_THREADS 64
+#define TRACE_THREAD_NAME_SIZE 32
+
+typedef struct __TraceEvent {
+  const char *name;   // Static string
+  const char *detail; // Static string shown as args.detail, or NULL
+  uint64_t start;     // ns, CLOCK_MONOTONIC
+  uint64_t duration;  // ns
+  uint32_t tid;       // Index in TraceRing.threads
+  int32_t frame;      // -1 outside of frames
+} TraceEvent;
+
+typedef struct __TraceRing {
+  TraceEvent *events; // NULL while tracing is off
+  size_t mask;        // Capacity - 1, a power of two
+  atomic_size_t next; // Events recorded so far
+  atomic_uint threadCount;
+  char threads[TRACE_MAX_THREADS][TRACE_THREAD_NAME_SIZE];
+  uint64_t origin; // Start of the trace
+} TraceRing;
+
+static TraceRing traceRing;
+static __thread uint32_t traceThread = UINT32_MAX;
+
+static uint64_t traceNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Start tracing into a ring of `capacity` events, rounded up to a power of
+ * two. Returns -1 if it cannot be allocated.
+ */
+static int traceInit(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  TraceEvent *events = malloc(size * sizeof(TraceEvent));
+  if (events == NULL)
+    return -1;
+  memset(events, 0, size * sizeof(TraceEvent)); // Fault the pages in now
+  traceRing.mask = size - 1;
+  traceRing.origin = traceNow();
+  traceRing.events = events;
+  return 0;
+}
+
+static int traceEnabled(void) { return traceRing.events != NULL; }
+
+// Name the calling thread in the trace, "main" if never named.
+static void traceThreadName(const char *name) {
+  if (!traceEnabled())
+    return;
+  if (traceThread == UINT32_MAX)
+    traceThread = atomic_fetch_add(&traceRing.threadCount, 1);
+  if (traceThread < TRACE_MAX_THREADS)
+    snprintf(traceRing.threads[traceThread], TRACE_THREAD_NAME_SIZE, "%s",
+             name);
+}
+
+// Start of a span, 0 while tracing is off.
+static uint64_t traceBegin(void) { return traceEnabled() ? traceNow() : 0; }
+
+// Record the span `name` of `frame` that started at `start` (traceBegin).
+static void traceEnd(const char *name, const char *detail, int frame,
+                     uint64_t start) {
+  if (start == 0 || !traceEnabled())
+    return;
+  uint64_t end = traceNow();
+  if (traceThread == UINT32_MAX)
+    traceThreadName("main");
+  size_t index = atomic_fetch_add_explicit(&traceRing.next, 1,
+                                           memory_order_relaxed);
+  TraceEvent *event = &traceRing.events[index & traceRing.mask];
+  event->name = name;
+  event->detail = detail;
+  event->start = start;
+  event->duration = end - start;
+  event->tid = traceThread;
+  event->frame = frame;
+}
+
+/**
+ * Write the recorded events to `path` as Chrome trace-event JSON. Recording
+ * threads must have stopped. Returns -1 if the file cannot be written.
+ */
+static int traceWrite(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  size_t next = atomic_load(&traceRing.next);
+  size_t capacity = traceRing.mask + 1;
+  size_t first = next > capacity ? next - capacity : 0;
+  unsigned int threads = atomic_load(&traceRing.threadCount);
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  fprintf(f, "{\"ph\": \"M\", \"pid\": 1, \"name\": \"process_name\", "
+             "\"args\": {\"name\": \"shadertoy\"}}");
+  for (unsigned int t = 0; t < threads && t < TRACE_MAX_THREADS; t++)
+    fprintf(f,
+            ",\n{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": "
+            "\"thread_name\", \"args\": {\"name\": \"%s\"}}",
+            t, traceRing.threads[t]);
+  for (size_t i = first; i < next; i++) {
+    const TraceEvent *event = &traceRing.events[i & traceRing.mask];
+    fprintf(f,
+            ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"name\": \"%s\", "
+            "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d",
+            event->tid, event->name, (event->start - traceRing.origin) / 1e3,
+            event->duration / 1e3, event->frame);
+    if (event->detail != NULL)
+      fprintf(f, ", \"detail\": \"%s\"", event->detail);
+    fprintf(f, "}}");
+  }
+  fprintf(f, "\n]}\n");
+  printf("Trace: %zu events written to %s", next - first, path);
+  if (first > 0)
+    printf(", %zu older events overwritten", first);
+  printf("\n");
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+static void traceDestroy(void) {
+  free(traceRing.events);
+  memset(&traceRing, 0, sizeof(traceRing));
+}
@@ -0,0 +1,57 @@
+/**
+ * uniforms.h - Shadertoy inputs as one std140 uniform block.
+ *
+ * Every pass reads its inputs from the `ShadertoyInputs` block at binding
+ * SHADERTOY_UNIFORM_BINDING. One buffer holds a copy of the block per pass,
+ * filled on the CPU and uploaded with a single glNamedBufferSubData per frame;
+ * each pass binds its own range of it. The copies only differ in the values
+ * that depend on the pass: iResolution, iChannelResolution and iTileOffset.
+ */
+#pragma once
+#include "timeline.h"
+#include <time.h>
+
+#define SHADERTOY_UNIFORM_BINDING 0
+
+/**
+ * C mirror of the GLSL block in shader.h. std140 rounds vec3 up to 16 bytes
+ * and gives every array element, float ones included, a 16-byte stride.
+ */
+typedef struct __ShadertoyUniforms {
+  GLfloat iResolution[3];
+  GLfloat iTime;
+  GLfloat iTimeDelta;
+  GLfloat iFrameRate;
+  GLint iFrame;
+  GLfloat pad0;
+  GLfloat iMouse[4];
+  GLfloat iDate[4];                 // Year, month (0-11), day, seconds
+  GLfloat iChannelTime[4][4];       // .x of each element
+  GLfloat iChannelResolution[4][4]; // .xyz of each element
+  GLfloat iTileOffset[2];
+  GLfloat pad1[2];
+} ShadertoyUniforms;
+_Static_assert(sizeof(ShadertoyUniforms) == 208, "std140 layout mismatch");
+
+// iDate of the local date `seconds` since 1970, see FrameTime.date.
+static void shadertoyDate(double seconds, GLfloat date[4]) {
+  time_t whole = (time_t)seconds;
+  struct tm tm;
+  gmtime_r(&whole, &tm); // Already local, no time zone to apply
+  date[0] = tm.tm_year + 1900;
+  date[1] = tm.tm_mon;
+  date[2] = tm.tm_mday;
+  date[3] = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec +
+            (float)(seconds - (double)whole);
+}
+
+// Inputs of a pass that only depend on the frame; the rest stays zero.
+static void shadertoyFrameUniforms(const FrameTime *time,
+                                   ShadertoyUniforms *u) {
+  memset(u, 0, sizeof(*u));
+  u->iTime = time->time;
+  u->iTimeDelta = time->timeDelta;
+  u->iFrameRate = time->frameRate;
+  u->iFrame = time->frame;
+  shadertoyDate(time->date, u->iDate);
+}
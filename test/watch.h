@@ -0,0 +1,110 @@
+/**
+ * watch.h - inotify watch of a few files.
+ *
+ * The parent directory of each file is watched rather than the file itself:
+ * editors that save by writing a new file and renaming it over the old one
+ * would otherwise leave the watch on a deleted inode. A file counts as changed
+ * when it is closed after writing or moved into place, never while it is still
+ * being written.
+ */
+#pragma once
+#include <libgen.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define FILE_WATCH_MAX 8
+#define FILE_WATCH_SETTLE_MS 50 // Quiet time that ends a burst of events
+
+typedef struct __FileWatch {
+  int fd; // inotify instance
+  int count;
+  int wd[FILE_WATCH_MAX];      // Watch of the directory, -1 for NULL files
+  char *names[FILE_WATCH_MAX]; // Base name in that directory
+} FileWatch;
+
+/**
+ * Watch `files`, NULL entries are skipped but keep their index. Returns -1 if
+ * inotify or one of the directories cannot be watched.
+ */
+static int fileWatchInit(FileWatch *watch, const char *const *files,
+                         int count) {
+  memset(watch, 0, sizeof(*watch));
+  if (count > FILE_WATCH_MAX)
+    return -1;
+  watch->count = count;
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd < 0) {
+    perror("inotify_init1");
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    watch->wd[i] = -1;
+    if (files[i] == NULL)
+      continue;
+    char *dir = strdup(files[i]);
+    char *base = strdup(files[i]);
+    if (dir == NULL || base == NULL) {
+      free(dir);
+      free(base);
+      return -1;
+    }
+    watch->names[i] = strdup(basename(base));
+    watch->wd[i] = inotify_add_watch(watch->fd, dirname(dir),
+                                     IN_CLOSE_WRITE | IN_MOVED_TO);
+    free(dir);
+    free(base);
+    if (watch->wd[i] < 0 || watch->names[i] == NULL) {
+      perror(files[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Bits of the files changed by the pending events, without waiting.
+static unsigned int fileWatchRead(FileWatch *watch) {
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  unsigned int changed = 0;
+  ssize_t len;
+  while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      for (int i = 0; event->len > 0 && i < watch->count; i++) {
+        if (watch->wd[i] == event->wd &&
+            strcmp(watch->names[i], event->name) == 0)
+          changed |= 1u << i;
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return changed;
+}
+
+/**
+ * Wait up to `timeoutMs` for changes, then until the files have been quiet
+ * for FILE_WATCH_SETTLE_MS so a save that touches several of them reloads
+ * once. Returns a bit per changed file index, 0 on timeout.
+ */
+static unsigned int fileWatchWait(FileWatch *watch, int timeoutMs) {
+  struct pollfd pfd = {.fd = watch->fd, .events = POLLIN};
+  unsigned int changed = 0;
+  int timeout = timeoutMs;
+  while (poll(&pfd, 1, timeout) > 0) {
+    changed |= fileWatchRead(watch);
+    timeout = FILE_WATCH_SETTLE_MS;
+  }
+  return changed;
+}
+
+static void fileWatchDestroy(FileWatch *watch) {
+  for (int i = 0; i < watch->count; i++)
+    free(watch->names[i]);
+  if (watch->fd > 0)
+    close(watch->fd);
+  memset(watch, 0, sizeof(*watch));
+}
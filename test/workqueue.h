@@ -0,0 +1,76 @@
+/**
+ * workqueue.h - Lock-free work-stealing distribution of frame indices.
+ *
+ * Frames [first, last] are dealt round-robin: worker w owns frames
+ * first + w, first + w + N, ... as local indices [head, tail). The owner takes
+ * its lowest frame from the head; an idle worker steals the highest frame from
+ * the tail of a busy one. Head and tail share one 64-bit word so both ends
+ * are updated with a single CAS. Round-robin dealing keeps frames finishing
+ * roughly in order, which keeps the output reorder window small.
+ */
+#pragma once
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct __WorkQueue {
+  int workers;
+  uint64_t first;           // First frame index
+  _Atomic uint64_t *ranges; // Per worker: head << 32 | tail
+  atomic_ullong steals;
+} WorkQueue;
+
+static int workQueueInit(WorkQueue *queue, int workers, uint64_t first,
+                         uint64_t last) {
+  queue->workers = workers;
+  queue->first = first;
+  atomic_init(&queue->steals, 0);
+  queue->ranges = calloc(workers, sizeof(*queue->ranges));
+  if (!queue->ranges)
+    return -1;
+  uint64_t count = last >= first ? last - first + 1 : 0;
+  for (int w = 0; w < workers; w++) {
+    uint64_t owned = count / workers + ((uint64_t)w < count % workers);
+    atomic_init(&queue->ranges[w], owned);
+  }
+  return 0;
+}
+
+static void workQueueDestroy(WorkQueue *queue) {
+  free(queue->ranges);
+  queue->ranges = NULL;
+}
+
+// Take local index from the head (own) or the tail (steal) of `victim`.
+static int workQueueTake(WorkQueue *queue, int victim, int fromTail,
+                         uint64_t *frame) {
+  uint64_t range = atomic_load(&queue->ranges[victim]);
+  for (;;) {
+    uint64_t head = range >> 32, tail = range & 0xffffffffULL;
+    if (head >= tail)
+      return 0;
+    uint64_t index = fromTail ? tail - 1 : head;
+    uint64_t next = fromTail ? (head << 32) | (tail - 1)
+                             : ((head + 1) << 32) | tail;
+    if (atomic_compare_exchange_weak(&queue->ranges[victim], &range, next)) {
+      *frame = queue->first + victim + index * queue->workers;
+      return 1;
+    }
+  }
+}
+
+/**
+ * Get the next frame for `worker`. Returns 0 once every frame has been
+ * handed out.
+ */
+static int workQueueNext(WorkQueue *queue, int worker, uint64_t *frame) {
+  if (workQueueTake(queue, worker, 0, frame))
+    return 1;
+  for (int i = 1; i < queue->workers; i++) {
+    if (workQueueTake(queue, (worker + i) % queue->workers, 1, frame)) {
+      atomic_fetch_add(&queue->steals, 1);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * yuv.h - RGB to Y'CbCr conversion parameters shared by the GPU conversion
+ * pass and the CPU fallback used for YUV4MPEG2 streams.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+typedef enum __YuvLayout {
+  YUV_NONE, // RGBA, no conversion
+  YUV_I420, // Y plane, then U plane, then V plane (yuv420p)
+  YUV_NV12, // Y plane, then interleaved UV plane
+} YuvLayout;
+
+typedef enum __YuvMatrix {
+  YUV_BT709,
+  YUV_BT601,
+} YuvMatrix;
+
+/**
+ * yuv = m * rgb + offset, with rgb in [0, 1] and yuv in 8-bit code values
+ * ([0, 255]). Rows are Y, Cb, Cr.
+ */
+typedef struct __YuvCoefficients {
+  float m[3][3];
+  float offset[3];
+} YuvCoefficients;
+
+static int parseYuvLayout(const char *name, YuvLayout *layout) {
+  if (strcmp(name, "i420") == 0 || strcmp(name, "yuv420p") == 0)
+    *layout = YUV_I420;
+  else if (strcmp(name, "nv12") == 0)
+    *layout = YUV_NV12;
+  else if (strcmp(name, "none") == 0 || strcmp(name, "rgba") == 0)
+    *layout = YUV_NONE;
+  else
+    return -1;
+  return 0;
+}
+
+static int parseYuvMatrix(const char *name, YuvMatrix *matrix) {
+  if (strcmp(name, "bt709") == 0)
+    *matrix = YUV_BT709;
+  else if (strcmp(name, "bt601") == 0)
+    *matrix = YUV_BT601;
+  else
+    return -1;
+  return 0;
+}
+
+static void yuvCoefficients(YuvMatrix matrix, int fullRange,
+                            YuvCoefficients *c) {
+  const float kr = matrix == YUV_BT601 ? 0.299f : 0.2126f;
+  const float kb = matrix == YUV_BT601 ? 0.114f : 0.0722f;
+  const float kg = 1.0f - kr - kb;
+  const float yScale = fullRange ? 255.0f : 219.0f;
+  const float cScale = fullRange ? 255.0f : 224.0f;
+  // Pb = (B - Y') / (2 (1 - kb)), Pr = (R - Y') / (2 (1 - kr))
+  const float cb = cScale / (2.0f * (1.0f - kb));
+  const float cr = cScale / (2.0f * (1.0f - kr));
+  const YuvCoefficients out = {
+      .m =
+          {
+              {kr * yScale, kg * yScale, kb * yScale},
+              {-kr * cb, -kg * cb, (1.0f - kb) * cb},
+              {(1.0f - kr) * cr, -kg * cr, -kb * cr},
+          },
+      .offset = {fullRange ? 0.0f : 16.0f, 128.0f, 128.0f},
+  };
+  *c = out;
+}
+
+// Size in bytes of a 4:2:0 frame, chroma rounded up for odd sizes.
+static size_t yuv420Size(unsigned int width, unsigned int height) {
+  return (size_t)width * height +
+         2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+static inline int roundToInt(float v) {
+  return (int)(v < 0.0f ? v - 0.5f : v + 0.5f);
+}
+
+static inline unsigned char clampByte(int v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : (unsigned char)v);
+}
+
+/**
+ * Convert bottom-up RGBA to top-down planar I420 on the CPU, chroma is the
+ * average of each 2x2 block.
+ */
+static void rgbaToI420(const unsigned char *rgba, unsigned int width,
+                       unsigned int height, const YuvCoefficients *c,
+                       unsigned char *dst) {
+  const unsigned int cw = (width + 1) / 2, ch = (height + 1) / 2;
+  unsigned char *yPlane = dst;
+  unsigned char *uPlane = yPlane + (size_t)width * height;
+  unsigned char *vPlane = uPlane + (size_t)cw * ch;
+  // 10-bit fixed point on 8-bit inputs.
+  int k[3][3];
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      k[i][j] = roundToInt(c->m[i][j] * 1024.0f / 255.0f);
+  const int yOff = (int)c->offset[0], uOff = (int)c->offset[1],
+            vOff = (int)c->offset[2];
+  for (unsigned int y = 0; y < height; y++) {
+    const unsigned char *src = rgba + (size_t)(height - 1 - y) * width * 4;
+    unsigned char *row = yPlane + (size_t)y * width;
+    for (unsigned int x = 0; x < width; x++, src += 4)
+      row[x] = clampByte(
+          ((k[0][0] * src[0] + k[0][1] * src[1] + k[0][2] * src[2] + 512) >>
+           10) +
+          yOff);
+  }
+  for (unsigned int cy = 0; cy < ch; cy++) {
+    unsigned int y0 = cy * 2, y1 = y0 + 1 < height ? y0 + 1 : y0;
+    const unsigned char *r0 = rgba + (size_t)(height - 1 - y0) * width * 4;
+    const unsigned char *r1 = rgba + (size_t)(height - 1 - y1) * width * 4;
+    for (unsigned int cx = 0; cx < cw; cx++) {
+      unsigned int x0 = cx * 2 * 4, x1 = cx * 2 + 1 < width ? x0 + 4 : x0;
+      int r = r0[x0] + r0[x1] + r1[x0] + r1[x1];
+      int g = r0[x0 + 1] + r0[x1 + 1] + r1[x0 + 1] + r1[x1 + 1];
+      int b = r0[x0 + 2] + r0[x1 + 2] + r1[x0 + 2] + r1[x1 + 2];
+      // Sums of 4 samples: shift by 10 + 2.
+      uPlane[(size_t)cy * cw + cx] = clampByte(
+          ((k[1][0] * r + k[1][1] * g + k[1][2] * b + 2048) >> 12) + uOff);
+      vPlane[(size_t)cy * cw + cx] = clampByte(
+          ((k[2][0] * r + k[2][1] * g + k[2][2] * b + 2048) >> 12) + vOff);
+    }
+  }
+}